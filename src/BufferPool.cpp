@@ -0,0 +1,110 @@
+#include "BufferPool.hpp"
+
+BufferPool::BufferPool(size_t maxFreeBuffers)
+    : _maxFreeBuffers(maxFreeBuffers)
+    , _numInUse(0)
+    , _released(false)
+{}
+
+BufferPool::~BufferPool()
+{
+    for (auto& buffer : _freeBuffers)
+        cv::fastFree(buffer.second);
+}
+
+cv::Mat BufferPool::acquire(int rows, int cols, int type)
+{
+    cv::Mat img;
+    img.allocator = this;
+    img.create(rows, cols, type);
+    return img;
+}
+
+void BufferPool::release()
+{
+    bool unused = false;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        _released = true;
+        unused = _numInUse == 0;
+    }
+
+    if (unused)
+        delete this;
+}
+
+cv::UMatData* BufferPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                                   cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const
+{
+    // Same layout as OpenCV's own allocator
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--)
+    {
+        if (step)
+        {
+            if (data && step[i] != CV_AUTOSTEP)
+                total = step[i];
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->size = total;
+    if (data)
+    {
+        u->data = u->origdata = static_cast<uchar*>(data);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    uchar* buffer = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto itr = _freeBuffers.find(total);
+        if (itr != _freeBuffers.end())
+        {
+            buffer = itr->second;
+            _freeBuffers.erase(itr);
+        }
+        _numInUse++;
+    }
+
+    if (!buffer)
+        buffer = static_cast<uchar*>(cv::fastMalloc(total));
+    u->data = u->origdata = buffer;
+    return u;
+}
+
+bool BufferPool::allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const
+{
+    return data != nullptr;
+}
+
+void BufferPool::deallocate(cv::UMatData* data) const
+{
+    if (!data)
+        return;
+
+    if (data->flags & cv::UMatData::USER_ALLOCATED)
+    {
+        delete data;
+        return;
+    }
+
+    bool unused = false;
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (!_released && _freeBuffers.size() < _maxFreeBuffers)
+            _freeBuffers.emplace(data->size, data->origdata);
+        else
+            cv::fastFree(data->origdata);
+        _numInUse--;
+        unused = _released && _numInUse == 0;
+    }
+    delete data;
+
+    if (unused)
+        delete this;
+}
@@ -0,0 +1,49 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+
+// Allocator that keeps the pixel buffers of released images for the next images of the same
+// size. A Mat made by acquire returns its buffer when the last Mat sharing it is released,
+// wherever that happens, so a buffer is never reused while a job or the caller still holds it.
+// The owner calls release instead of deleting the pool, which then lives on until every
+// buffer it handed out was returned.
+class BufferPool : public cv::MatAllocator
+{
+public:
+    BufferPool(size_t maxFreeBuffers);
+
+    cv::Mat acquire(int rows, int cols, int type);
+    void release();
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+private:
+    ~BufferPool();
+
+    size_t _maxFreeBuffers;
+    mutable std::mutex _lock;
+    mutable std::multimap<size_t, uchar*> _freeBuffers; // Keyed by size in bytes
+    mutable size_t _numInUse;
+    bool _released;
+};
@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <sstream>
+
+#include "HomographyEstimator.hpp"
+
+const int SAMPLE_SIZE = 4;
+const int HYPOTHESIS_BATCH_SIZE = 64;
+const uint64_t SAMPLER_SEED = 0x5eed5eed;
+
+const std::string HomographyEstimator::getParamsSignature()
+{
+    std::ostringstream signature;
+    signature << "prosac=" << _reprojThreshold << "," << _confidence << "," << _maxIterations;
+    return signature.str();
+}
+
+void HomographyEstimator::toPointSet(const std::vector<cv::Point2f>& srcPoints,
+                                     const std::vector<cv::Point2f>& dstPoints,
+                                     PointSet& points)
+{
+    size_t numPoints = srcPoints.size();
+    points.srcX.resize(numPoints);
+    points.srcY.resize(numPoints);
+    points.dstX.resize(numPoints);
+    points.dstY.resize(numPoints);
+    for (size_t i = 0; i < numPoints; i++)
+    {
+        points.srcX[i] = srcPoints[i].x;
+        points.srcY[i] = srcPoints[i].y;
+        points.dstX[i] = dstPoints[i].x;
+        points.dstY[i] = dstPoints[i].y;
+    }
+}
+
+const int HomographyEstimator::countInliers(const cv::Matx33d& homog, const PointSet& points, std::vector<uchar>* inlierMask)
+{
+    const float h0 = homog(0, 0), h1 = homog(0, 1), h2 = homog(0, 2);
+    const float h3 = homog(1, 0), h4 = homog(1, 1), h5 = homog(1, 2);
+    const float h6 = homog(2, 0), h7 = homog(2, 1), h8 = homog(2, 2);
+    const float threshold = static_cast<float>(_reprojThreshold * _reprojThreshold);
+    const float* srcX = points.srcX.data();
+    const float* srcY = points.srcY.data();
+    const float* dstX = points.dstX.data();
+    const float* dstY = points.dstY.data();
+    const int numPoints = static_cast<int>(points.srcX.size());
+
+    if (inlierMask)
+        inlierMask->resize(numPoints);
+    uchar* mask = inlierMask ? inlierMask->data() : nullptr;
+
+    int numInliers(0);
+    #pragma omp simd reduction(+:numInliers)
+    for (int i = 0; i < numPoints; i++)
+    {
+        float w = h6 * srcX[i] + h7 * srcY[i] + h8;
+        float invW = w != 0.0f ? 1.0f / w : 0.0f;
+        float dx = (h0 * srcX[i] + h1 * srcY[i] + h2) * invW - dstX[i];
+        float dy = (h3 * srcX[i] + h4 * srcY[i] + h5) * invW - dstY[i];
+        int inlier = (w > 0.0f) & (dx * dx + dy * dy <= threshold);
+        numInliers += inlier;
+        if (mask)
+            mask[i] = static_cast<uchar>(inlier);
+    }
+
+    return numInliers;
+}
+
+const bool HomographyEstimator::isDegenerateSample(const cv::Point2f* points)
+{
+    // Any three collinear points leave the homography underdetermined
+    for (int i = 0; i < SAMPLE_SIZE; i++)
+    {
+        for (int j = i + 1; j < SAMPLE_SIZE; j++)
+        {
+            for (int k = j + 1; k < SAMPLE_SIZE; k++)
+            {
+                cv::Point2f a = points[j] - points[i];
+                cv::Point2f b = points[k] - points[i];
+                if (std::abs(a.cross(b)) <= FLT_EPSILON * (std::abs(a.x * b.y) + std::abs(a.y * b.x)) + 1e-3f)
+                    return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+const bool HomographyEstimator::estimate(const std::vector<cv::Point2f>& srcPoints,
+                                         const std::vector<cv::Point2f>& dstPoints,
+                                         cv::Mat& homog)
+{
+    const int numPoints = static_cast<int>(srcPoints.size());
+    if (numPoints < SAMPLE_SIZE || dstPoints.size() != srcPoints.size())
+    {
+        std::cerr << "Error(HomographyEstimator::estimate): Not enough correspondences - " << numPoints << std::endl;
+        return false;
+    }
+
+    PointSet points;
+    toPointSet(srcPoints, dstPoints, points);
+
+    // PROSAC growth function: sampling starts from the SAMPLE_SIZE best matches and the subset
+    // grows so that, by the time maxIterations is reached, it spans every correspondence
+    int subsetSize = SAMPLE_SIZE;
+    double subsetSamples = _maxIterations;
+    for (int i = 0; i < SAMPLE_SIZE; i++)
+        subsetSamples *= static_cast<double>(subsetSize - i) / (numPoints - i);
+    double subsetGrowIteration = 1.0;
+
+    cv::RNG rng(SAMPLER_SEED);
+    cv::Matx33d bestHomog;
+    int bestInliers(0);
+    int requiredIterations = _maxIterations;
+    int iteration(0);
+    std::vector<cv::Matx33d> batchHomogs(HYPOTHESIS_BATCH_SIZE);
+    std::vector<int> batchInliers(HYPOTHESIS_BATCH_SIZE);
+    std::vector<std::array<cv::Point2f, SAMPLE_SIZE * 2>> batchSamples(HYPOTHESIS_BATCH_SIZE);
+    while (iteration < requiredIterations)
+    {
+        // Samples are drawn serially so the PROSAC schedule and the results are deterministic
+        int batchSize = std::min(HYPOTHESIS_BATCH_SIZE, requiredIterations - iteration);
+        for (int b = 0; b < batchSize; b++)
+        {
+            ++iteration;
+            if (iteration > subsetGrowIteration && subsetSize < numPoints)
+            {
+                double nextSubsetSamples = subsetSamples * (subsetSize + 1) / (subsetSize + 1 - SAMPLE_SIZE);
+                subsetGrowIteration += std::ceil(nextSubsetSamples - subsetSamples);
+                subsetSamples = nextSubsetSamples;
+                ++subsetSize;
+            }
+
+            // The newest match of the subset is always part of the sample until the subset grows again
+            int sample[SAMPLE_SIZE];
+            int numDrawn(0);
+            if (iteration <= subsetGrowIteration)
+                sample[numDrawn++] = subsetSize - 1;
+            int drawRange = iteration <= subsetGrowIteration ? subsetSize - 1 : subsetSize;
+            while (numDrawn < SAMPLE_SIZE)
+            {
+                int idx = rng.uniform(0, drawRange);
+                if (std::find(sample, sample + numDrawn, idx) == sample + numDrawn)
+                    sample[numDrawn++] = idx;
+            }
+
+            for (int i = 0; i < SAMPLE_SIZE; i++)
+            {
+                batchSamples[b][i] = srcPoints[sample[i]];
+                batchSamples[b][SAMPLE_SIZE + i] = dstPoints[sample[i]];
+            }
+        }
+
+        #pragma omp parallel for schedule(static)
+        for (int b = 0; b < batchSize; b++)
+        {
+            batchInliers[b] = 0;
+            const cv::Point2f* src = batchSamples[b].data();
+            const cv::Point2f* dst = src + SAMPLE_SIZE;
+            if (isDegenerateSample(src) || isDegenerateSample(dst))
+                continue;
+
+            cv::Mat hypothesis = cv::getPerspectiveTransform(src, dst);
+            batchHomogs[b] = cv::Matx33d(hypothesis.ptr<double>());
+            if (!cv::checkRange(hypothesis) || std::abs(cv::determinant(hypothesis)) < DBL_EPSILON)
+                continue;
+
+            batchInliers[b] = countInliers(batchHomogs[b], points);
+        }
+
+        // Every new best hypothesis lowers the number of iterations needed to reach the confidence target
+        for (int b = 0; b < batchSize; b++)
+        {
+            if (batchInliers[b] <= bestInliers)
+                continue;
+
+            bestInliers = batchInliers[b];
+            bestHomog = batchHomogs[b];
+            double inlierRatio = static_cast<double>(bestInliers) / numPoints;
+            double noOutlierSampleProb = std::pow(inlierRatio, SAMPLE_SIZE);
+            if (noOutlierSampleProb >= 1.0 - DBL_EPSILON)
+            {
+                requiredIterations = iteration;
+            }
+            else if (noOutlierSampleProb > DBL_EPSILON)
+            {
+                double iterations = std::log(1.0 - _confidence) / std::log(1.0 - noOutlierSampleProb);
+                requiredIterations = std::min(requiredIterations, static_cast<int>(std::ceil(iterations)));
+            }
+        }
+    }
+
+    if (bestInliers < SAMPLE_SIZE)
+    {
+        std::cerr << "Error(HomographyEstimator::estimate): No homography found for " << numPoints << " correspondences." << std::endl;
+        return false;
+    }
+
+    // Refine on all inliers of the best hypothesis, kept only if it explains at least as many points
+    std::vector<uchar> inlierMask;
+    countInliers(bestHomog, points, &inlierMask);
+    std::vector<cv::Point2f> inlierSrc, inlierDst;
+    for (int i = 0; i < numPoints; i++)
+    {
+        if (inlierMask[i])
+        {
+            inlierSrc.push_back(srcPoints[i]);
+            inlierDst.push_back(dstPoints[i]);
+        }
+    }
+
+    cv::Mat refined = cv::findHomography(inlierSrc, inlierDst, 0);
+    if (!refined.empty() && countInliers(cv::Matx33d(refined.ptr<double>()), points) >= bestInliers)
+        homog = refined;
+    else
+        homog = cv::Mat(bestHomog);
+
+    return true;
+}
+
+const bool HomographyEstimator::verify(const cv::Mat& homog,
+                                       const std::vector<cv::Point2f>& srcPoints,
+                                       const std::vector<cv::Point2f>& dstPoints,
+                                       double minInlierRatio)
+{
+    if (homog.empty() || srcPoints.size() < SAMPLE_SIZE || dstPoints.size() != srcPoints.size())
+        return false;
+
+    PointSet points;
+    toPointSet(srcPoints, dstPoints, points);
+    cv::Mat homog64;
+    homog.convertTo(homog64, CV_64F);
+    int numInliers = countInliers(cv::Matx33d(homog64.ptr<double>()), points);
+    return numInliers >= SAMPLE_SIZE && numInliers >= minInlierRatio * srcPoints.size();
+}
@@ -0,0 +1,67 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// RANSAC homography estimation tuned for registration latency. Samples are drawn PROSAC
+// style, starting from the best matches and widening to the whole set, hypotheses are scored
+// in batches spread over threads with a vectorised inlier count, and the search stops as soon
+// as the confidence target is met.
+class HomographyEstimator
+{
+public:
+    HomographyEstimator(double reprojThreshold = 3.0, double confidence = 0.995, int maxIterations = 2000)
+        : _reprojThreshold(reprojThreshold)
+        , _confidence(confidence)
+        , _maxIterations(maxIterations)
+    {}
+    ~HomographyEstimator() {};
+
+    const std::string getParamsSignature();
+
+    // Maps srcPoints onto dstPoints. Correspondences must be sorted by match quality, best first.
+    const bool estimate(const std::vector<cv::Point2f>& srcPoints,
+                        const std::vector<cv::Point2f>& dstPoints,
+                        cv::Mat& homog);
+
+    // Single hypothesis check of a known homography, true if at least minInlierRatio of the
+    // correspondences agree with it
+    const bool verify(const cv::Mat& homog,
+                      const std::vector<cv::Point2f>& srcPoints,
+                      const std::vector<cv::Point2f>& dstPoints,
+                      double minInlierRatio);
+
+private:
+    // Structure of arrays so the inlier count vectorises
+    struct PointSet
+    {
+        std::vector<float> srcX, srcY, dstX, dstY;
+    };
+
+    static void toPointSet(const std::vector<cv::Point2f>& srcPoints,
+                           const std::vector<cv::Point2f>& dstPoints,
+                           PointSet& points);
+    const int countInliers(const cv::Matx33d& homog, const PointSet& points, std::vector<uchar>* inlierMask = nullptr);
+    static const bool isDegenerateSample(const cv::Point2f* points);
+
+    double _reprojThreshold;
+    double _confidence;
+    int _maxIterations;
+};
@@ -21,6 +21,7 @@ bool ImageLoader::loadImages(std::string imgDirPath)
 
     unsigned int id = std::stoul(imgDirPath.substr(subDirBeginIdx, imgDirPath.size() - subDirBeginIdx));
     std::vector<cv::Mat> imgs;
+    std::vector<cv::Mat> regImgs;
     std::set<int> imgNameOrdered;
     for (const auto &entry : std::filesystem::directory_iterator(imgDirPath))
     {
@@ -28,17 +29,34 @@ bool ImageLoader::loadImages(std::string imgDirPath)
         if (ext != ".jpg" && ext != ".png")
             continue;
 
-        cv::Mat img = cv::imread(entry.path().string());
+        cv::Mat img = cv::imread(entry.path().string(), _imreadFlags);
         if (img.empty())
         {
             std::cerr << "Error(loadImages): Could not load image - " << entry.path() << std::endl;
             return false;
         }
 
+        // Decoded separately rather than resized from img, so JPEGs are only partially decoded
+        cv::Mat regImg;
+        if (_registrationScale > 1)
+        {
+            int regFlags = _registrationScale == 8 ? cv::IMREAD_REDUCED_GRAYSCALE_8 :
+                           _registrationScale == 4 ? cv::IMREAD_REDUCED_GRAYSCALE_4 : cv::IMREAD_REDUCED_GRAYSCALE_2;
+            regImg = cv::imread(entry.path().string(), regFlags);
+            if (regImg.empty())
+            {
+                std::cerr << "Error(loadImages): Could not load registration image - " << entry.path() << std::endl;
+                return false;
+            }
+        }
+
         int imgPosition = std::stoul(entry.path().stem().string().c_str());
         imgPosition = imgPosition > 0 ? imgPosition : 0;
         imgNameOrdered.insert(imgPosition);
-        imgs.insert(imgs.begin() + std::distance(imgNameOrdered.begin(), imgNameOrdered.find(imgPosition)), std::move(img));
+        size_t insertIdx = std::distance(imgNameOrdered.begin(), imgNameOrdered.find(imgPosition));
+        imgs.insert(imgs.begin() + insertIdx, std::move(img));
+        if (_registrationScale > 1)
+            regImgs.insert(regImgs.begin() + insertIdx, std::move(regImg));
     }
 
     if (imgs.empty())
@@ -58,19 +76,25 @@ bool ImageLoader::loadImages(std::string imgDirPath)
     }
 
     std::shared_ptr<std::vector<cv::Mat>> storedImgs;
+    std::shared_ptr<std::vector<cv::Mat>> storedRegImgs;
     if (idIdx != -1)
     {
         storedImgs = _imgPairs.at(idIdx).second;
+        storedRegImgs = _regImgPairs.at(idIdx).second;
     }
     else
     {
         storedImgs = std::make_shared<std::vector<cv::Mat>>();
+        storedRegImgs = std::make_shared<std::vector<cv::Mat>>();
         _imgPairs.emplace_back(ImgIdPair(id, storedImgs));
+        _regImgPairs.emplace_back(ImgIdPair(id, storedRegImgs));
         _maxLoadedImgId = std::max(_maxLoadedImgId, id);
     }
 
     for (auto& img : imgs)
         storedImgs->push_back(std::move(img));
+    for (auto& regImg : regImgs)
+        storedRegImgs->push_back(std::move(regImg));
 
     return true;
 }
@@ -172,6 +196,29 @@ const bool ImageLoader::popImage(unsigned int id, cv::Mat& img)
     return false;
 }
 
+const bool ImageLoader::popImage(unsigned int id, cv::Mat& img, cv::Mat& regImg)
+{
+    regImg.release();
+    for (size_t i = 0; i < _imgPairs.size(); i++)
+    {
+        if (_imgPairs[i].first != id)
+            continue;
+
+        if (!popImage(id, img))
+            return false;
+
+        // Images added without a registration copy leave it empty
+        if (i < _regImgPairs.size() && !_regImgPairs[i].second->empty())
+        {
+            regImg = std::move(_regImgPairs[i].second->front());
+            _regImgPairs[i].second->erase(_regImgPairs[i].second->begin());
+        }
+        return true;
+    }
+
+    return false;
+}
+
 bool ImageLoader::addImage(unsigned int id, cv::Mat& img)
 {    
     if (img.empty())
@@ -196,6 +243,7 @@ bool ImageLoader::addImage(unsigned int id, cv::Mat& img)
     {
         storedImgs = std::make_shared<std::vector<cv::Mat>>();
         _imgPairs.emplace_back(ImgIdPair(id, storedImgs));
+        _regImgPairs.emplace_back(ImgIdPair(id, std::make_shared<std::vector<cv::Mat>>()));
         _maxLoadedImgId = std::max(_maxLoadedImgId, id);
     }
 
@@ -228,6 +276,7 @@ bool ImageLoader::addImages(unsigned int id, std::vector<cv::Mat>& imgs)
     {
         storedImgs = std::make_shared<std::vector<cv::Mat>>();
         _imgPairs.emplace_back(ImgIdPair(id, storedImgs));
+        _regImgPairs.emplace_back(ImgIdPair(id, std::make_shared<std::vector<cv::Mat>>()));
         _maxLoadedImgId = std::max(_maxLoadedImgId, id);
     }
 
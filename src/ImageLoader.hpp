@@ -25,8 +25,12 @@ typedef std::pair<unsigned int, std::shared_ptr<std::vector<cv::Mat>>> ImgIdPair
 
 class ImageLoader {
 public:
-    ImageLoader()
+    // A registration scale of 2, 4 or 8 also decodes a reduced grayscale copy of every image for
+    // registration. JPEG images are reduced in the DCT domain, so this costs far less than a full decode.
+    ImageLoader(int imreadFlags = cv::IMREAD_COLOR, int registrationScale = 1)
         : _maxLoadedImgId(0)
+        , _imreadFlags(imreadFlags)
+        , _registrationScale(registrationScale)
     {}
 
     const unsigned int getMaxImgId() { return _maxLoadedImgId; }
@@ -40,11 +44,18 @@ public:
     const bool getImage(unsigned int id, cv::Mat& img);
 
     const bool popImage(unsigned int id, cv::Mat& img);
+    const bool popImage(unsigned int id, cv::Mat& img, cv::Mat& regImg);
+
+    const int getRegistrationScale() { return _registrationScale; }
+    static const bool isValidRegistrationScale(int scale) { return scale == 1 || scale == 2 || scale == 4 || scale == 8; }
 
     bool addImage(unsigned int id, cv::Mat& img);
     bool addImages(unsigned int id, std::vector<cv::Mat>& imgs);
 
 private:
     std::vector<ImgIdPair> _imgPairs;
+    std::vector<ImgIdPair> _regImgPairs; // Reduced registration images, in the same order as _imgPairs
     unsigned int _maxLoadedImgId;
+    int _imreadFlags;
+    int _registrationScale;
 };
\ No newline at end of file
@@ -1,7 +1,47 @@
+#include <climits>
+#include <sstream>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 #include "ImageStitcher.hpp"
+#include "PixelTraits.hpp"
 
 const int MAX_FEATURES = 500;
 const float GOOD_MATCH_PERCENT = 0.15f;
+const std::string FEATURE_MATCHER = "BruteForce-Hamming"; // ORB descriptors are binary
+const double PRIOR_MIN_INLIER_RATIO = 0.5;
+const int INCREMENTAL_BLOCK_SIZE = 32; // Source block compared against the previous frame
+const int INCREMENTAL_TILE_SIZE = 64; // Canvas tile warped again when a changed block reaches it
+const int INCREMENTAL_CHANGE_THRESHOLD = 8; // Largest 8-bit channel difference still deemed unchanged
+const unsigned int INCREMENTAL_REFRESH_FRAMES = 120; // Incremental composites before a full one
+const int GUIDED_MATCH_RADIUS = 16; // Pixels around the predicted location searched for a match
+const int GUIDED_ROI_MARGIN = 32; // Pixels around the predicted overlap still searched for features
+const int GUIDED_MIN_ROI_SIZE = 64; // Predicted overlaps smaller than this fall back to the whole ROI
+const size_t GUIDED_MIN_MATCHES = 20; // Guided matches needed to estimate a drifted registration from them
+
+const std::string ImageStitcher::getParamsSignature()
+{
+    // Every setting that changes the stitched output must be part of this signature
+    std::ostringstream signature;
+    signature << "features=" << MAX_FEATURES << ";goodMatch=" << GOOD_MATCH_PERCENT << ";matcher=" << FEATURE_MATCHER
+              << ";" << HomographyEstimator().getParamsSignature() << ";prior=" << PRIOR_MIN_INLIER_RATIO
+              << ";guidedRadius=" << GUIDED_MATCH_RADIUS << ";guidedMargin=" << GUIDED_ROI_MARGIN
+              << ";guidedMinMatches=" << GUIDED_MIN_MATCHES;
+    return signature.str();
+}
+
+cv::Mat ImageStitcher::scaleHomography(const cv::Mat& homog, double scale)
+{
+    // S * H * S^-1 with S = diag(scale, scale, 1)
+    cv::Mat scaled;
+    homog.convertTo(scaled, CV_64F);
+    scaled.at<double>(0, 2) *= scale;
+    scaled.at<double>(1, 2) *= scale;
+    scaled.at<double>(2, 0) /= scale;
+    scaled.at<double>(2, 1) /= scale;
+    return scaled;
+}
 
 void ImageStitcher::setHomography(const cv::Mat& homog)
 {
@@ -24,6 +64,44 @@ const bool ImageStitcher::getHomography(cv::Mat& homog)
     return false;
 }
 
+void ImageStitcher::setCanvasBounds(const cv::Rect& bounds)
+{
+    _fixedCanvasBounds = bounds;
+}
+
+void ImageStitcher::setWarpMap(const cv::Mat& warpMap, const cv::Size& srcSize)
+{
+    _warpMap = warpMap;
+    _warpMapSrcSize = srcSize;
+}
+
+void ImageStitcher::buildWarpMap(const cv::Mat& homog, const cv::Size& canvasSize, cv::Mat& warpMap)
+{
+    // Same mapping warpPerspective computes per call, done once: canvas pixel -> source pixel
+    cv::Mat invHomog;
+    homog.convertTo(invHomog, CV_64F);
+    invHomog = invHomog.inv();
+    const double* h = invHomog.ptr<double>(0);
+
+    cv::Mat mapX(canvasSize, CV_32FC1), mapY(canvasSize, CV_32FC1);
+    for (int y = 0; y < canvasSize.height; y++)
+    {
+        float* rowX = mapX.ptr<float>(y);
+        float* rowY = mapY.ptr<float>(y);
+        for (int x = 0; x < canvasSize.width; x++)
+        {
+            double w = h[6] * x + h[7] * y + h[8];
+            w = w != 0.0 ? 1.0 / w : 0.0;
+            rowX[x] = static_cast<float>((h[0] * x + h[1] * y + h[2]) * w);
+            rowY[x] = static_cast<float>((h[3] * x + h[4] * y + h[5]) * w);
+        }
+    }
+
+    // Fixed-point map for nearest neighbour lookups
+    cv::Mat unused;
+    cv::convertMaps(mapX, mapY, warpMap, unused, CV_16SC2, true);
+}
+
 const bool ImageStitcher::computeHomography(const std::pair<cv::Mat, cv::Mat>& imgs,
                                             cv::Mat& homog)
 {
@@ -57,30 +135,145 @@ const bool ImageStitcher::computeHomography(const std::pair<cv::Mat, cv::Mat>& i
     cv::Rect leftImgRoi(leftImgWidthOffset, 0, leftImgWidthRoi, minImgHeight);
     cv::Rect rightImgRoi(0, 0, rightImgWidthRoi, minImgHeight);
 
+    if (leftImg.type() != rightImg.type() || !isSupportedPixelType(leftImg.type()))
+    {
+        std::cerr << "Error(computeHomography): Unsupported or mismatched image types - "
+                  << leftImg.type() << ", " << rightImg.type() << std::endl;
+        return false;
+    }
+
+    // A fixed rig barely moves between frames, so the previous registration guides the matching
+    // and then only needs verifying
+    bool hasPrior = !_priorHomography.empty() && _priorLeftRoi == leftImgRoi && _priorRightRoi == rightImgRoi;
+    std::vector<cv::Point2f> points1, points2;
+    if (hasPrior && matchFeatures(leftImg, rightImg, leftImgRoi, rightImgRoi, _priorHomography, points1, points2))
+    {
+        if (_estimator.verify(_priorHomography, points2, points1, PRIOR_MIN_INLIER_RATIO))
+        {
+            homog = _priorHomography.clone();
+            return true;
+        }
+
+        // A rig that drifted past the verify threshold but within the search radius is still matched
+        // correctly, so the guided matches are enough to register it again
+        if (points1.size() >= GUIDED_MIN_MATCHES && _estimator.estimate(points2, points1, homog) &&
+            _estimator.verify(homog, points2, points1, PRIOR_MIN_INLIER_RATIO))
+        {
+            _priorHomography = homog.clone();
+            return true;
+        }
+    }
+
+    // Otherwise search the whole ROIs
+    points1.clear();
+    points2.clear();
+    matchFeatures(leftImg, rightImg, leftImgRoi, rightImgRoi, cv::Mat(), points1, points2);
+    if (hasPrior && _estimator.verify(_priorHomography, points2, points1, PRIOR_MIN_INLIER_RATIO))
+    {
+        homog = _priorHomography.clone();
+        return true;
+    }
+
+    // Find homography, the matches are already sorted best first for PROSAC sampling
+    if (!_estimator.estimate(points2, points1, homog))
+    {
+        std::cerr << "Error(computeHomography): Failed to estimate a homography from " << points1.size() << " matches." << std::endl;
+        return false;
+    }
+
+    _priorHomography = homog.clone();
+    _priorLeftRoi = leftImgRoi;
+    _priorRightRoi = rightImgRoi;
+    return true;
+}
+
+const bool ImageStitcher::matchFeatures(const cv::Mat& leftImg,
+                                        const cv::Mat& rightImg,
+                                        cv::Rect leftRoi,
+                                        cv::Rect rightRoi,
+                                        const cv::Mat& guide,
+                                        std::vector<cv::Point2f>& leftPts,
+                                        std::vector<cv::Point2f>& rightPts)
+{
+    // Only detect where the guide says each ROI overlaps the other one
+    cv::Mat guideInv;
+    if (!guide.empty())
+    {
+        guide.convertTo(guideInv, CV_64F);
+        guideInv = guideInv.inv();
+        cv::Rect leftOverlap = projectOverlap(guide, rightRoi, leftRoi);
+        cv::Rect rightOverlap = projectOverlap(guideInv, leftRoi, rightRoi);
+        if (leftOverlap.width < GUIDED_MIN_ROI_SIZE || leftOverlap.height < GUIDED_MIN_ROI_SIZE ||
+            rightOverlap.width < GUIDED_MIN_ROI_SIZE || rightOverlap.height < GUIDED_MIN_ROI_SIZE)
+            return false;
+
+        leftRoi = leftOverlap;
+        rightRoi = rightOverlap;
+    }
+
     // Convert image to grayscale
     cv::Mat leftGray, rightGray;
-    if (leftImg.type() != CV_8UC1)
-        cv::cvtColor(leftImg(leftImgRoi), leftGray, cv::COLOR_BGR2GRAY);
-    else
-        leftGray = leftImg;
-    if (rightImg.type() != CV_8UC1)
-        cv::cvtColor(rightImg(rightImgRoi), rightGray, cv::COLOR_BGR2GRAY);
-    else
-        rightGray = rightImg;
+    switch (leftImg.type())
+    {
+    case CV_8UC1:
+        toGray<uchar>(leftImg, leftRoi, leftGray);
+        toGray<uchar>(rightImg, rightRoi, rightGray);
+        break;
+    case CV_8UC3:
+        toGray<cv::Vec3b>(leftImg, leftRoi, leftGray);
+        toGray<cv::Vec3b>(rightImg, rightRoi, rightGray);
+        break;
+    case CV_8UC4:
+        toGray<cv::Vec4b>(leftImg, leftRoi, leftGray);
+        toGray<cv::Vec4b>(rightImg, rightRoi, rightGray);
+        break;
+    case CV_16UC3:
+        toGray<cv::Vec3w>(leftImg, leftRoi, leftGray);
+        toGray<cv::Vec3w>(rightImg, rightRoi, rightGray);
+        break;
+    }
 
     // Variables to store keypoints and descriptors
     std::vector<cv::KeyPoint> keypoints1, keypoints2;
     cv::Mat descriptors1, descriptors2;
 
-    // Detect ORB features and compute descriptors.
-    cv::Ptr<cv::Feature2D> orb = cv::ORB::create(MAX_FEATURES);
-    orb->detectAndCompute(leftGray, cv::Mat(), keypoints1, descriptors1);
-    orb->detectAndCompute(rightGray, cv::Mat(), keypoints2, descriptors2);
+    // Detect ORB features and compute descriptors, one detector per image so both run concurrently
+    // when the thread budget leaves this worker more than one thread
+    cv::Ptr<cv::Feature2D> leftOrb = cv::ORB::create(MAX_FEATURES);
+    cv::Ptr<cv::Feature2D> rightOrb = cv::ORB::create(MAX_FEATURES);
+    #pragma omp parallel sections num_threads(2) if(omp_get_max_threads() > 1)
+    {
+        #pragma omp section
+        leftOrb->detectAndCompute(leftGray, cv::Mat(), keypoints1, descriptors1);
+        #pragma omp section
+        rightOrb->detectAndCompute(rightGray, cv::Mat(), keypoints2, descriptors2);
+    }
+    if (keypoints1.empty() || keypoints2.empty())
+        return false;
+
+    // Keypoints in whole image coordinates
+    for (cv::KeyPoint& keypoint : keypoints1)
+    {
+        keypoint.pt.x += leftRoi.x;
+        keypoint.pt.y += leftRoi.y;
+    }
+    for (cv::KeyPoint& keypoint : keypoints2)
+    {
+        keypoint.pt.x += rightRoi.x;
+        keypoint.pt.y += rightRoi.y;
+    }
 
     // Match features.
     std::vector<cv::DMatch> matches;
-    cv::Ptr<cv::DescriptorMatcher> matcher = cv::DescriptorMatcher::create("BruteForce");
-    matcher->match(descriptors1, descriptors2, matches, cv::Mat());
+    if (guideInv.empty())
+    {
+        cv::Ptr<cv::DescriptorMatcher> matcher = cv::DescriptorMatcher::create(FEATURE_MATCHER);
+        matcher->match(descriptors1, descriptors2, matches, cv::Mat());
+    }
+    else
+    {
+        guidedMatch(keypoints1, descriptors1, keypoints2, descriptors2, rightRoi, guideInv, matches);
+    }
 
     // Sort matches by score
     std::sort(matches.begin(), matches.end());
@@ -90,22 +283,86 @@ const bool ImageStitcher::computeHomography(const std::pair<cv::Mat, cv::Mat>& i
     matches.erase(matches.begin() + numGoodMatches, matches.end());
 
     // Extract location of good matches
-    std::vector<cv::Point2f> points1, points2;
-    //#pragma omp parallel for num_threads(8)
     for (int i = 0; i < matches.size(); i++)
     {
-        cv::Point2f queryPt = keypoints1[matches[i].queryIdx].pt;
-        queryPt.x += leftImgWidthOffset;
+        leftPts.push_back(keypoints1[matches[i].queryIdx].pt);
+        rightPts.push_back(keypoints2[matches[i].trainIdx].pt);
+    }
+
+    return !leftPts.empty();
+}
 
-        cv::Point2f trainPt = keypoints2[matches[i].trainIdx].pt;
-        points1.push_back(queryPt);
-        points2.push_back(trainPt);
+cv::Rect ImageStitcher::projectOverlap(const cv::Mat& homog, const cv::Rect& srcRoi, const cv::Rect& dstRoi)
+{
+    std::vector<cv::Point2f> corners = { cv::Point2f(srcRoi.x, srcRoi.y),
+                                         cv::Point2f(srcRoi.x + srcRoi.width, srcRoi.y),
+                                         cv::Point2f(srcRoi.x, srcRoi.y + srcRoi.height),
+                                         cv::Point2f(srcRoi.x + srcRoi.width, srcRoi.y + srcRoi.height) };
+    cv::perspectiveTransform(corners, corners, homog);
+    cv::Rect bounds = cv::boundingRect(corners);
+    bounds = cv::Rect(bounds.x - GUIDED_ROI_MARGIN, bounds.y - GUIDED_ROI_MARGIN,
+                      bounds.width + 2 * GUIDED_ROI_MARGIN, bounds.height + 2 * GUIDED_ROI_MARGIN);
+    return bounds & dstRoi;
+}
+
+void ImageStitcher::guidedMatch(const std::vector<cv::KeyPoint>& leftKeypoints,
+                                const cv::Mat& leftDescriptors,
+                                const std::vector<cv::KeyPoint>& rightKeypoints,
+                                const cv::Mat& rightDescriptors,
+                                const cv::Rect& rightRoi,
+                                const cv::Mat& guideInv,
+                                std::vector<cv::DMatch>& matches)
+{
+    // Bucket the right keypoints in a grid with a cell per search radius
+    int gridWidth = rightRoi.width / GUIDED_MATCH_RADIUS + 1;
+    int gridHeight = rightRoi.height / GUIDED_MATCH_RADIUS + 1;
+    std::vector<std::vector<int>> grid(gridWidth * gridHeight);
+    for (int i = 0; i < rightKeypoints.size(); i++)
+    {
+        int cellX = std::min(gridWidth - 1, std::max(0, static_cast<int>(rightKeypoints[i].pt.x - rightRoi.x) / GUIDED_MATCH_RADIUS));
+        int cellY = std::min(gridHeight - 1, std::max(0, static_cast<int>(rightKeypoints[i].pt.y - rightRoi.y) / GUIDED_MATCH_RADIUS));
+        grid[cellY * gridWidth + cellX].push_back(i);
     }
 
-    // Find homography
-    homog = cv::findHomography(points2, points1, cv::RANSAC);
+    // Predict where every left keypoint is in the right image
+    std::vector<cv::Point2f> predicted;
+    for (const cv::KeyPoint& keypoint : leftKeypoints)
+        predicted.push_back(keypoint.pt);
+    cv::perspectiveTransform(predicted, predicted, guideInv);
 
-    return true;
+    // Only compare descriptors of the right keypoints within the radius of the prediction
+    const float maxDistSq = static_cast<float>(GUIDED_MATCH_RADIUS * GUIDED_MATCH_RADIUS);
+    for (int i = 0; i < predicted.size(); i++)
+    {
+        int cellX = static_cast<int>(std::floor((predicted[i].x - rightRoi.x) / GUIDED_MATCH_RADIUS));
+        int cellY = static_cast<int>(std::floor((predicted[i].y - rightRoi.y) / GUIDED_MATCH_RADIUS));
+        int bestIdx(-1);
+        int bestDist(INT_MAX);
+        for (int y = std::max(0, cellY - 1); y <= std::min(gridHeight - 1, cellY + 1); y++)
+        {
+            for (int x = std::max(0, cellX - 1); x <= std::min(gridWidth - 1, cellX + 1); x++)
+            {
+                for (int j : grid[y * gridWidth + x])
+                {
+                    float dx = rightKeypoints[j].pt.x - predicted[i].x;
+                    float dy = rightKeypoints[j].pt.y - predicted[i].y;
+                    if (dx * dx + dy * dy > maxDistSq)
+                        continue;
+
+                    int dist = cv::hal::normHamming(leftDescriptors.ptr<uchar>(i), rightDescriptors.ptr<uchar>(j),
+                                                    leftDescriptors.cols);
+                    if (dist < bestDist)
+                    {
+                        bestDist = dist;
+                        bestIdx = j;
+                    }
+                }
+            }
+        }
+
+        if (bestIdx >= 0)
+            matches.push_back(cv::DMatch(i, bestIdx, static_cast<float>(bestDist)));
+    }
 }
 
 const bool ImageStitcher::manualStitch(const cv::Mat& homog,
@@ -117,6 +374,132 @@ const bool ImageStitcher::manualStitch(const cv::Mat& homog,
         std::cerr << "Error(stitchImages): No homography or img pairs provided." << std::endl;
         return false;
     }
+
+    // Dispatch once for the whole job to the path specialised for its pixel format
+    int type = imgPairs.front().second.type();
+    for (const auto& imgPair : imgPairs)
+    {
+        if ((!imgPair.first.empty() && imgPair.first.type() != type) ||
+            (!imgPair.second.empty() && imgPair.second.type() != type))
+        {
+            std::cerr << "Error(stitchImages): All images in a stitch job must share the same type." << std::endl;
+            return false;
+        }
+    }
+
+    switch (type)
+    {
+    case CV_8UC1:
+        return manualStitchPairs<uchar>(homog, imgPairs, stitchedImgs);
+    case CV_8UC3:
+        return manualStitchPairs<cv::Vec3b>(homog, imgPairs, stitchedImgs);
+    case CV_8UC4:
+        return manualStitchPairs<cv::Vec4b>(homog, imgPairs, stitchedImgs);
+    case CV_16UC3:
+        return manualStitchPairs<cv::Vec3w>(homog, imgPairs, stitchedImgs);
+    default:
+        std::cerr << "Error(stitchImages): Unsupported image type - " << type << std::endl;
+        return false;
+    }
+}
+
+const bool ImageStitcher::compositeTiled(const std::vector<cv::Mat>& imgs,
+                                         const std::vector<cv::Mat>& canvasHomogs,
+                                         float scale,
+                                         TiledCanvas& canvas,
+                                         const TiledCanvas::TileSink& sink)
+{
+    if (imgs.empty() || imgs.size() != canvasHomogs.size())
+    {
+        std::cerr << "Error(compositeTiled): Every image needs a canvas homography." << std::endl;
+        return false;
+    }
+
+    // Canvas area each camera reaches at the output scale
+    std::vector<cv::Mat> homogs;
+    std::vector<cv::Rect> reach;
+    cv::Rect canvasRect(0, 0, canvas.getSize().width, canvas.getSize().height);
+    for (size_t i = 0; i < imgs.size(); i++)
+    {
+        homogs.push_back(scaleHomography(canvasHomogs[i], scale));
+        std::vector<cv::Point2f> corners = { cv::Point2f(0, 0), cv::Point2f(imgs[i].cols * scale, 0),
+                                             cv::Point2f(0, imgs[i].rows * scale),
+                                             cv::Point2f(imgs[i].cols * scale, imgs[i].rows * scale) };
+        cv::perspectiveTransform(corners, corners, homogs.back());
+        cv::Rect bounds = cv::boundingRect(corners);
+        bounds.width += 1;
+        bounds.height += 1;
+        reach.push_back(bounds & canvasRect);
+    }
+
+    // Furthest right any camera before i reaches, tile columns past it are final once camera i is done
+    std::vector<int> remainingReach(imgs.size(), 0);
+    for (size_t i = 1; i < imgs.size(); i++)
+        remainingReach[i] = std::max(remainingReach[i - 1], reach[i - 1].x + reach[i - 1].width);
+
+    int tileSize = canvas.getTileSize();
+    int nextReleaseX = canvas.getTilesX() - 1;
+    for (int i = static_cast<int>(imgs.size()) - 1; i >= 0; i--)
+    {
+        cv::Mat img = imgs[i];
+        if (scale != 1.0)
+            cv::resize(imgs[i], img, cv::Size(), scale, scale, cv::INTER_AREA);
+
+        if (!reach[i].empty())
+        {
+            for (int tileY = reach[i].y / tileSize; tileY * tileSize < reach[i].y + reach[i].height; tileY++)
+            {
+                for (int tileX = reach[i].x / tileSize; tileX * tileSize < reach[i].x + reach[i].width; tileX++)
+                {
+                    cv::Mat tile = canvas.getTile(tileX, tileY);
+                    if (tile.empty())
+                        return false;
+
+                    // Shift the canvas homography so the tile origin is at 0,0
+                    cv::Matx33d tileOffset(1, 0, -tileX * tileSize, 0, 1, -tileY * tileSize, 0, 0, 1);
+                    cv::Mat tileHomog = cv::Mat(tileOffset) * homogs[i];
+                    cv::warpPerspective(img, tile, tileHomog, tile.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+                }
+            }
+        }
+
+        // Stream out the columns no remaining camera can reach
+        for (; nextReleaseX >= 0 && nextReleaseX * tileSize >= remainingReach[i]; nextReleaseX--)
+        {
+            for (int tileY = 0; tileY < canvas.getTilesY(); tileY++)
+            {
+                if (!canvas.releaseTile(nextReleaseX, tileY, sink))
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+template <typename PixelT>
+void ImageStitcher::toGray(const cv::Mat& img, const cv::Rect& roi, cv::Mat& gray)
+{
+    typedef PixelTraits<PixelT> Traits;
+    if (Traits::grayConversion < 0)
+    {
+        // Already single channel, only the ROI is needed
+        gray = img(roi);
+        return;
+    }
+
+    cv::cvtColor(img(roi), gray, Traits::grayConversion);
+    if (gray.depth() != CV_8U)
+        gray.convertTo(gray, CV_8U, Traits::grayScale);
+}
+
+template <typename PixelT>
+const bool ImageStitcher::manualStitchPairs(const cv::Mat& homog,
+                                            const std::vector<std::pair<cv::Mat, cv::Mat>>& imgPairs,
+                                            std::vector<cv::Mat>& stitchedImgs)
+{
+    typedef PixelTraits<PixelT> Traits;
+
     //#pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < imgPairs.size(); i++)
     {
@@ -134,45 +517,227 @@ const bool ImageStitcher::manualStitch(const cv::Mat& homog,
         unsigned int minImgHeight = std::min(leftImg.rows, rightImg.rows);
         unsigned int totalImgWidth = leftImg.cols + rightImg.cols;
         cv::Rect rightImgRoi(0, 0, rightImg.cols, minImgHeight);
-        cv::Mat stitchedImg(cv::Size(totalImgWidth, minImgHeight), rightImg.type());
-        cv::warpPerspective(rightImg(rightImgRoi), stitchedImg, homog, stitchedImg.size(),
-                            cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0, 255, 0));
+        bool incremental = _incremental && imgPairs.size() == 1;
+        if (incremental && compositeIncremental<PixelT>(homog, leftImg, rightImg(rightImgRoi), stitchedImgs))
+            continue;
+
+        cv::Mat stitchedImg(cv::Size(totalImgWidth, minImgHeight), Traits::type);
+        bool useWarpMap = !_warpMap.empty() && _warpMap.size() == stitchedImg.size() && _warpMapSrcSize == rightImgRoi.size();
+        if (useWarpMap)
+            cv::remap(rightImg(rightImgRoi), stitchedImg, _warpMap, cv::Mat(),
+                      cv::INTER_NEAREST, cv::BORDER_CONSTANT, Traits::borderValue());
+        else
+            cv::warpPerspective(rightImg(rightImgRoi), stitchedImg, homog, stitchedImg.size(),
+                                cv::INTER_NEAREST, cv::BORDER_CONSTANT, Traits::borderValue());
 
-        // Now find the extra pixels
+        // Now find the extra pixels, unless the bounds are already known for this canvas
         int widthEndIdx = totalImgWidth;
         int widthStartIdx = 0;
         int widthPadding = totalImgWidth * 0.10;
         int initImgHeight = minImgHeight * 0.10;
         int maxHeightIdx = minImgHeight - initImgHeight;
         int heightIdx = initImgHeight;
+        cv::Mat validMask;
+        bool useFixedBounds = !_fixedCanvasBounds.empty() &&
+                              _fixedCanvasBounds.height == static_cast<int>(minImgHeight) &&
+                              _fixedCanvasBounds.x + _fixedCanvasBounds.width <= static_cast<int>(totalImgWidth);
+        if (useFixedBounds)
+        {
+            widthStartIdx = _fixedCanvasBounds.x;
+            widthEndIdx = _fixedCanvasBounds.width;
+            heightIdx = maxHeightIdx;
+        }
+        else
+        {
+            // Warp a mask of where the right image lands, image content matching the border colour is not cropped
+            cv::Mat rightMask(rightImgRoi.size(), CV_8UC1, cv::Scalar(255));
+            if (useWarpMap)
+                cv::remap(rightMask, validMask, _warpMap, cv::Mat(), cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+            else
+                cv::warpPerspective(rightMask, validMask, homog, stitchedImg.size(),
+                                    cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+        }
         for (; heightIdx < maxHeightIdx; heightIdx++)
         {
+            const uchar* row = validMask.ptr<uchar>(heightIdx);
+
             // Find the extra end pixels
             for (; widthEndIdx > leftImg.cols; widthEndIdx--)
             {
-                if (stitchedImg.at<cv::Vec3b>(heightIdx, widthEndIdx - 1) != cv::Vec3b(0, 255, 0))
-                {
+                if (row[widthEndIdx - 1] != 0)
                     break;
-                }
             }
 
             // Find the extra beginning pixels
             for (; widthStartIdx < leftImg.cols + widthPadding; widthStartIdx++)
             {
-                if (stitchedImg.at<cv::Vec3b>(heightIdx, widthStartIdx) != cv::Vec3b(0, 255, 0))
-                {
+                if (row[widthStartIdx] != 0)
                     break;
-                }
             }
         }
-        widthStartIdx = widthStartIdx > leftImg.cols ? widthStartIdx - leftImg.cols : 0;
+        if (!useFixedBounds)
+            widthStartIdx = widthStartIdx > leftImg.cols ? widthStartIdx - leftImg.cols : 0;
+        _canvasBounds = cv::Rect(widthStartIdx, 0, widthEndIdx, minImgHeight);
 
         // Copy the left image onto the canvas
         cv::Rect leftImgRoi(widthStartIdx, 0, leftImg.cols, minImgHeight);
         leftImg(leftImgRoi).copyTo(stitchedImg(leftImgRoi));
 
+        // Keep what the next frame is composited against, the output itself may outlive this stitcher
+        if (incremental)
+        {
+            std::lock_guard<std::mutex> lock(_incremental->lock);
+            _incremental->homography = homog.clone();
+            leftImg.copyTo(_incremental->left);
+            rightImg(rightImgRoi).copyTo(_incremental->right);
+            stitchedImg.copyTo(_incremental->canvas);
+            _incremental->leftRoi = leftImgRoi;
+            _incremental->bounds = _canvasBounds;
+            _incremental->frames = 0;
+        }
+
         stitchedImgs.push_back(std::move(stitchedImg(cv::Rect(widthStartIdx, 0, widthEndIdx, minImgHeight))));
     }
 
     return true;
 }
+
+template <typename PixelT>
+void ImageStitcher::findChangedBlocks(const cv::Mat& img, const cv::Mat& refImg, std::vector<cv::Rect>& blocks)
+{
+    typedef typename cv::DataType<PixelT>::channel_type ChannelT;
+    const int numChannels = cv::DataType<PixelT>::channels;
+    const int threshold = static_cast<int>(INCREMENTAL_CHANGE_THRESHOLD / PixelTraits<PixelT>::grayScale);
+
+    int blocksX = (img.cols + INCREMENTAL_BLOCK_SIZE - 1) / INCREMENTAL_BLOCK_SIZE;
+    std::vector<uchar> changed(blocksX);
+    for (int blockY = 0; blockY < img.rows; blockY += INCREMENTAL_BLOCK_SIZE)
+    {
+        std::fill(changed.begin(), changed.end(), 0);
+        int blockEndY = std::min(img.rows, blockY + INCREMENTAL_BLOCK_SIZE);
+        for (int y = blockY; y < blockEndY; y++)
+        {
+            const ChannelT* row = img.ptr<ChannelT>(y);
+            const ChannelT* refRow = refImg.ptr<ChannelT>(y);
+            for (int blockX = 0; blockX < blocksX; blockX++)
+            {
+                if (changed[blockX])
+                    continue;
+
+                // Largest channel difference over the block row, vectorised across the channels
+                int start = blockX * INCREMENTAL_BLOCK_SIZE * numChannels;
+                int end = std::min(img.cols, (blockX + 1) * INCREMENTAL_BLOCK_SIZE) * numChannels;
+                int maxDiff = 0;
+                #pragma omp simd reduction(max:maxDiff)
+                for (int i = start; i < end; i++)
+                    maxDiff = std::max(maxDiff, std::abs(static_cast<int>(row[i]) - static_cast<int>(refRow[i])));
+                changed[blockX] = maxDiff > threshold;
+            }
+        }
+
+        for (int blockX = 0; blockX < blocksX; blockX++)
+        {
+            if (!changed[blockX])
+                continue;
+
+            int x = blockX * INCREMENTAL_BLOCK_SIZE;
+            blocks.push_back(cv::Rect(x, blockY, std::min(INCREMENTAL_BLOCK_SIZE, img.cols - x), blockEndY - blockY));
+        }
+    }
+}
+
+template <typename PixelT>
+const bool ImageStitcher::compositeIncremental(const cv::Mat& homog,
+                                               const cv::Mat& leftImg,
+                                               const cv::Mat& rightImg,
+                                               std::vector<cv::Mat>& stitchedImgs)
+{
+    typedef PixelTraits<PixelT> Traits;
+
+    // Workers compositing the same pair take turns on the shared canvas
+    IncrementalCanvas& state = *_incremental;
+    std::lock_guard<std::mutex> lock(state.lock);
+
+    // The kept canvas is only valid for the same registration and image sizes, and is rebuilt
+    // every so often so differences under the threshold cannot pile up
+    if (state.canvas.empty() || ++state.frames >= INCREMENTAL_REFRESH_FRAMES ||
+        leftImg.size() != state.left.size() || rightImg.size() != state.right.size() ||
+        leftImg.type() != state.left.type() || rightImg.type() != state.right.type() ||
+        homog.type() != state.homography.type() || cv::norm(homog, state.homography, cv::NORM_INF) != 0.0)
+        return false;
+
+    std::vector<cv::Rect> leftBlocks, rightBlocks;
+    findChangedBlocks<PixelT>(leftImg, state.left, leftBlocks);
+    findChangedBlocks<PixelT>(rightImg, state.right, rightBlocks);
+
+    // The left image is copied onto the canvas as is, right image blocks land where the homography takes them
+    cv::Rect canvasRect(0, 0, state.canvas.cols, state.canvas.rows);
+    int tilesX = (canvasRect.width + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    int tilesY = (canvasRect.height + INCREMENTAL_TILE_SIZE - 1) / INCREMENTAL_TILE_SIZE;
+    std::vector<uchar> dirtyTiles(tilesX * tilesY, 0);
+    auto markDirty = [&](cv::Rect rect)
+    {
+        rect &= canvasRect;
+        if (rect.empty())
+            return;
+
+        for (int tileY = rect.y / INCREMENTAL_TILE_SIZE; tileY * INCREMENTAL_TILE_SIZE < rect.y + rect.height; tileY++)
+        {
+            for (int tileX = rect.x / INCREMENTAL_TILE_SIZE; tileX * INCREMENTAL_TILE_SIZE < rect.x + rect.width; tileX++)
+                dirtyTiles[tileY * tilesX + tileX] = 1;
+        }
+    };
+    for (const cv::Rect& block : leftBlocks)
+        markDirty(block);
+    for (const cv::Rect& block : rightBlocks)
+    {
+        // Nearest neighbour sampling can pick a block pixel for canvas pixels just outside its warped corners
+        std::vector<cv::Point2f> corners = { cv::Point2f(block.x - 1, block.y - 1),
+                                             cv::Point2f(block.x + block.width + 1, block.y - 1),
+                                             cv::Point2f(block.x - 1, block.y + block.height + 1),
+                                             cv::Point2f(block.x + block.width + 1, block.y + block.height + 1) };
+        cv::perspectiveTransform(corners, corners, homog);
+        cv::Rect bounds = cv::boundingRect(corners);
+        markDirty(cv::Rect(bounds.x - 1, bounds.y - 1, bounds.width + 2, bounds.height + 2));
+    }
+
+    // Same warp and copy as a full composite, one tile at a time
+    bool useWarpMap = !_warpMap.empty() && _warpMap.size() == state.canvas.size() && _warpMapSrcSize == rightImg.size();
+    for (int tileY = 0; tileY < tilesY; tileY++)
+    {
+        for (int tileX = 0; tileX < tilesX; tileX++)
+        {
+            if (!dirtyTiles[tileY * tilesX + tileX])
+                continue;
+
+            cv::Rect tileRect = cv::Rect(tileX * INCREMENTAL_TILE_SIZE, tileY * INCREMENTAL_TILE_SIZE,
+                                         INCREMENTAL_TILE_SIZE, INCREMENTAL_TILE_SIZE) & canvasRect;
+            cv::Mat tile = state.canvas(tileRect);
+            if (useWarpMap)
+            {
+                cv::remap(rightImg, tile, _warpMap(tileRect), cv::Mat(),
+                          cv::INTER_NEAREST, cv::BORDER_CONSTANT, Traits::borderValue());
+            }
+            else
+            {
+                cv::Matx33d tileOffset(1, 0, -tileRect.x, 0, 1, -tileRect.y, 0, 0, 1);
+                cv::warpPerspective(rightImg, tile, cv::Mat(tileOffset) * homog, tileRect.size(),
+                                    cv::INTER_NEAREST, cv::BORDER_CONSTANT, Traits::borderValue());
+            }
+
+            cv::Rect leftRect = tileRect & state.leftRoi;
+            if (!leftRect.empty())
+                leftImg(leftRect).copyTo(state.canvas(leftRect));
+        }
+    }
+
+    // The kept sources now match the canvas wherever it was composited again
+    for (const cv::Rect& block : leftBlocks)
+        leftImg(block).copyTo(state.left(block));
+    for (const cv::Rect& block : rightBlocks)
+        rightImg(block).copyTo(state.right(block));
+
+    _canvasBounds = state.bounds;
+    stitchedImgs.push_back(state.canvas(state.bounds).clone());
+    return true;
+}
@@ -16,8 +16,48 @@ Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+#include "HomographyEstimator.hpp"
+#include "TiledCanvas.hpp"
+
+// Canvas incremental composites are built on, with the source images as last composited onto it.
+// Shared by every worker compositing the same stitch pair, so each image group is compared with
+// the one composited just before it.
+struct IncrementalCanvas
+{
+    std::mutex lock;
+    unsigned int frames = 0; // Incremental composites since the last full one
+    cv::Mat homography;
+    cv::Mat left;
+    cv::Mat right;
+    cv::Mat canvas;
+    cv::Rect leftRoi;
+    cv::Rect bounds;
+};
+
+// The incremental canvas of every stitch pair, made on first use
+class IncrementalCanvases
+{
+public:
+    std::shared_ptr<IncrementalCanvas> get(unsigned int pairId)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_canvases.size() <= pairId)
+            _canvases.resize(pairId + 1);
+        if (!_canvases[pairId])
+            _canvases[pairId] = std::make_shared<IncrementalCanvas>();
+        return _canvases[pairId];
+    }
+
+private:
+    std::mutex _lock;
+    std::vector<std::shared_ptr<IncrementalCanvas>> _canvases;
+};
+
 class ImageStitcher {
 public:
     enum StitcherMode
@@ -29,11 +69,29 @@ public:
     ImageStitcher() {};
     ~ImageStitcher() {};
 
+    static const std::string getParamsSignature();
+
+    // Returns the homography expressed for both images resized by the given scale
+    static cv::Mat scaleHomography(const cv::Mat& homog, double scale);
+
     void setHomography(const cv::Mat& homog);
 
     const cv::Mat getHomography();
     const bool getHomography(cv::Mat& homog);
 
+    // Fixed canvas bounds skip the search for the warped image edges
+    void setCanvasBounds(const cv::Rect& bounds);
+    const cv::Rect getCanvasBounds() { return _canvasBounds; }
+
+    // A precomputed canvas to source lookup table replaces warpPerspective for that source size
+    void setWarpMap(const cv::Mat& warpMap, const cv::Size& srcSize);
+    static void buildWarpMap(const cv::Mat& homog, const cv::Size& canvasSize, cv::Mat& warpMap);
+
+    // Incremental compositing keeps the last canvas and only warps the canvas tiles that changed
+    // source blocks reach again, as long as the homography and image sizes stay the same. Off
+    // without a canvas.
+    void setIncremental(std::shared_ptr<IncrementalCanvas> canvas) { _incremental = canvas; }
+
     const bool computeHomography(const std::pair<cv::Mat, cv::Mat>& imgs,
                                  cv::Mat& homog);
     const bool computeHomography(const std::pair<cv::Mat, cv::Mat>& imgs,
@@ -45,6 +103,62 @@ public:
                             const std::vector<std::pair<cv::Mat, cv::Mat>>& imgPairs,
                             std::vector<cv::Mat>& stitchedImgs);
 
+    // Out-of-core compositing of a whole camera chain into a tiled canvas. canvasHomogs map each
+    // full resolution image into the full resolution canvas; the images are resized by scale one
+    // at a time. Cameras are warped from the last to the first so left images end up on top, and
+    // every tile column is handed to the sink as soon as no remaining camera can reach it.
+    static const bool compositeTiled(const std::vector<cv::Mat>& imgs,
+                                     const std::vector<cv::Mat>& canvasHomogs,
+                                     float scale,
+                                     TiledCanvas& canvas,
+                                     const TiledCanvas::TileSink& sink);
+
 private:
+    // Matches ORB features of the two ROIs, in whole image coordinates. With a guide homography
+    // (right image to left image), features are only detected in the overlap it predicts and
+    // each left feature is only matched against right features near its predicted location.
+    const bool matchFeatures(const cv::Mat& leftImg,
+                             const cv::Mat& rightImg,
+                             cv::Rect leftRoi,
+                             cv::Rect rightRoi,
+                             const cv::Mat& guide,
+                             std::vector<cv::Point2f>& leftPts,
+                             std::vector<cv::Point2f>& rightPts);
+    static cv::Rect projectOverlap(const cv::Mat& homog, const cv::Rect& srcRoi, const cv::Rect& dstRoi);
+    static void guidedMatch(const std::vector<cv::KeyPoint>& leftKeypoints,
+                            const cv::Mat& leftDescriptors,
+                            const std::vector<cv::KeyPoint>& rightKeypoints,
+                            const cv::Mat& rightDescriptors,
+                            const cv::Rect& rightRoi,
+                            const cv::Mat& guideInv,
+                            std::vector<cv::DMatch>& matches);
+
+    // Pixel-format specialised paths, instantiated for each type in PixelTraits.hpp
+    template <typename PixelT>
+    static void toGray(const cv::Mat& img, const cv::Rect& roi, cv::Mat& gray);
+
+    template <typename PixelT>
+    static void findChangedBlocks(const cv::Mat& img, const cv::Mat& refImg, std::vector<cv::Rect>& blocks);
+
+    template <typename PixelT>
+    const bool compositeIncremental(const cv::Mat& homog,
+                                    const cv::Mat& leftImg,
+                                    const cv::Mat& rightImg,
+                                    std::vector<cv::Mat>& stitchedImgs);
+
+    template <typename PixelT>
+    const bool manualStitchPairs(const cv::Mat& homog,
+                                 const std::vector<std::pair<cv::Mat, cv::Mat>>& imgPairs,
+                                 std::vector<cv::Mat>& stitchedImgs);
+
+    HomographyEstimator _estimator;
     cv::Mat _homography;
+    cv::Mat _priorHomography; // Last registration, verified first on the next frame
+    cv::Rect _priorLeftRoi;
+    cv::Rect _priorRightRoi;
+    cv::Rect _canvasBounds; // Bounds of the last stitched canvas
+    cv::Rect _fixedCanvasBounds;
+    cv::Mat _warpMap;
+    cv::Size _warpMapSrcSize;
+    std::shared_ptr<IncrementalCanvas> _incremental;
 };
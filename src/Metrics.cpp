@@ -0,0 +1,369 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "Metrics.hpp"
+
+const int METRICS_SOCKET_POLL_MS = 250;
+const int METRICS_REQUEST_WAIT_MS = 100;
+
+std::string formatLabels(const std::string& labels, const std::string& extraLabel = "")
+{
+    if (labels.empty() && extraLabel.empty())
+        return "";
+    if (labels.empty())
+        return "{" + extraLabel + "}";
+    if (extraLabel.empty())
+        return "{" + labels + "}";
+    return "{" + labels + "," + extraLabel + "}";
+}
+
+LatencyHistogram::LatencyHistogram()
+    : _count(0)
+    , _sumMicros(0)
+{
+    for (auto& bucket : _buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::record(std::chrono::steady_clock::duration duration)
+{
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    recordMicros(micros > 0 ? micros : 0);
+}
+
+void LatencyHistogram::recordMicros(uint64_t micros)
+{
+    _buckets[getBucket(micros)].fetch_add(1, std::memory_order_relaxed);
+    _sumMicros.fetch_add(micros, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned int LatencyHistogram::getBucket(uint64_t micros)
+{
+    // Values below NUM_SUB_BUCKETS each get their own bucket, larger values are bucketed by
+    // their highest set bit plus the SUB_BUCKET_BITS bits below it
+    if (micros < NUM_SUB_BUCKETS)
+        return static_cast<unsigned int>(micros);
+
+    unsigned int msb = 63;
+    while (!(micros >> msb))
+        --msb;
+    unsigned int octave = msb - SUB_BUCKET_BITS + 1;
+    unsigned int subBucket = (micros >> (msb - SUB_BUCKET_BITS)) & (NUM_SUB_BUCKETS - 1);
+    unsigned int bucket = octave * NUM_SUB_BUCKETS + subBucket;
+    return bucket < NUM_BUCKETS ? bucket : NUM_BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::getBucketUpperMicros(unsigned int bucket)
+{
+    unsigned int octave = bucket / NUM_SUB_BUCKETS;
+    unsigned int subBucket = bucket % NUM_SUB_BUCKETS;
+    if (octave == 0)
+        return subBucket;
+
+    uint64_t width = uint64_t(1) << (octave - 1);
+    uint64_t lower = uint64_t(NUM_SUB_BUCKETS + subBucket) << (octave - 1);
+    return lower + width - 1;
+}
+
+const uint64_t LatencyHistogram::getQuantileMicros(double quantile)
+{
+    uint64_t count = getCount();
+    if (count == 0)
+        return 0;
+
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(quantile * count + 0.5));
+    uint64_t cumulative(0);
+    for (unsigned int bucket = 0; bucket < NUM_BUCKETS; bucket++)
+    {
+        cumulative += getBucketCount(bucket);
+        if (cumulative >= target)
+            return getBucketUpperMicros(bucket);
+    }
+
+    return getBucketUpperMicros(NUM_BUCKETS - 1);
+}
+
+MetricCounter& MetricsRegistry::getCounter(const std::string& name,
+                                           const std::string& help,
+                                           const std::string& labels,
+                                           double valueScale)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& family = _counters[name];
+    if (family.metrics.empty())
+    {
+        family.help = help;
+        family.valueScale = valueScale;
+    }
+
+    auto& counter = family.metrics[labels];
+    if (!counter)
+        counter = std::make_unique<MetricCounter>();
+    return *counter;
+}
+
+LatencyHistogram& MetricsRegistry::getHistogram(const std::string& name,
+                                                const std::string& help,
+                                                const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& family = _histograms[name];
+    if (family.metrics.empty())
+    {
+        family.help = help;
+        family.valueScale = 1e-6;
+    }
+
+    auto& histogram = family.metrics[labels];
+    if (!histogram)
+        histogram = std::make_unique<LatencyHistogram>();
+    return *histogram;
+}
+
+void MetricsRegistry::setGauge(const std::string& name,
+                               const std::string& help,
+                               const std::string& labels,
+                               std::function<double()> sample)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto& family = _gauges[name];
+    family.help = help;
+    family.valueScale = 1.0;
+    family.metrics[labels] = sample;
+}
+
+void MetricsRegistry::removeGauge(const std::string& name, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto family = _gauges.find(name);
+    if (family == _gauges.end())
+        return;
+
+    family->second.metrics.erase(labels);
+    if (family->second.metrics.empty())
+        _gauges.erase(family);
+}
+
+const std::string MetricsRegistry::getSnapshot()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    std::ostringstream out;
+    out.precision(12);
+    for (auto& family : _counters)
+    {
+        out << "# HELP " << family.first << " " << family.second.help << "\n";
+        out << "# TYPE " << family.first << " counter\n";
+        for (auto& counter : family.second.metrics)
+            out << family.first << formatLabels(counter.first) << " "
+                << counter.second->get() * family.second.valueScale << "\n";
+    }
+
+    for (auto& family : _gauges)
+    {
+        out << "# HELP " << family.first << " " << family.second.help << "\n";
+        out << "# TYPE " << family.first << " gauge\n";
+        for (auto& gauge : family.second.metrics)
+            out << family.first << formatLabels(gauge.first) << " " << gauge.second() << "\n";
+    }
+
+    for (auto& family : _histograms)
+    {
+        out << "# HELP " << family.first << " " << family.second.help << "\n";
+        out << "# TYPE " << family.first << " histogram\n";
+        for (auto& histogram : family.second.metrics)
+        {
+            // Buckets are read one by one while workers keep recording, so the total count is
+            // taken from the buckets to keep the snapshot consistent
+            uint64_t cumulative(0);
+            for (unsigned int bucket = 0; bucket < LatencyHistogram::NUM_BUCKETS; bucket++)
+            {
+                cumulative += histogram.second->getBucketCount(bucket);
+                std::ostringstream le;
+                le.precision(12);
+                le << "le=\"" << LatencyHistogram::getBucketUpperMicros(bucket) * family.second.valueScale << "\"";
+                out << family.first << "_bucket" << formatLabels(histogram.first, le.str()) << " " << cumulative << "\n";
+            }
+            out << family.first << "_bucket" << formatLabels(histogram.first, "le=\"+Inf\"") << " " << cumulative << "\n";
+            out << family.first << "_sum" << formatLabels(histogram.first) << " "
+                << histogram.second->getSumMicros() * family.second.valueScale << "\n";
+            out << family.first << "_count" << formatLabels(histogram.first) << " " << cumulative << "\n";
+        }
+    }
+
+    return out.str();
+}
+
+MetricsExporter::MetricsExporter(std::shared_ptr<MetricsRegistry> registry,
+                                 const std::string& filePath,
+                                 const std::string& socketPath,
+                                 std::chrono::milliseconds interval)
+    : _registry(registry)
+    , _filePath(filePath)
+    , _socketPath(socketPath)
+    , _interval(interval)
+    , _socketFd(-1)
+    , _quit(false)
+{}
+
+bool MetricsExporter::start()
+{
+    if (!_socketPath.empty())
+    {
+#ifdef _WIN32
+        std::cerr << "Error(MetricsExporter::start): Unix sockets are not supported on this platform." << std::endl;
+        return false;
+#else
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (_socketPath.size() >= sizeof(addr.sun_path))
+        {
+            std::cerr << "Error(MetricsExporter::start): Socket path is too long - " << _socketPath << std::endl;
+            return false;
+        }
+        _socketPath.copy(addr.sun_path, _socketPath.size());
+
+        // Remove a socket left behind by a previous run
+        unlink(_socketPath.c_str());
+        _socketFd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (_socketFd < 0 || bind(_socketFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+            listen(_socketFd, 4) != 0)
+        {
+            std::cerr << "Error(MetricsExporter::start): Could not listen on socket - " << _socketPath << std::endl;
+            if (_socketFd >= 0)
+                close(_socketFd);
+            _socketFd = -1;
+            return false;
+        }
+        _socketThread = std::thread(&MetricsExporter::serveSocketLoop, this);
+#endif
+    }
+
+    if (!_filePath.empty())
+        _fileThread = std::thread(&MetricsExporter::writeFileLoop, this);
+
+    return true;
+}
+
+void MetricsExporter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_quitLock);
+        _quit = true;
+    }
+    _quitCondition.notify_all();
+
+    if (_fileThread.joinable())
+        _fileThread.join();
+    if (_socketThread.joinable())
+        _socketThread.join();
+
+#ifndef _WIN32
+    if (_socketFd >= 0)
+    {
+        close(_socketFd);
+        unlink(_socketPath.c_str());
+        _socketFd = -1;
+    }
+#endif
+}
+
+void MetricsExporter::writeFileLoop()
+{
+    std::unique_lock<std::mutex> lock(_quitLock);
+    while (!_quit)
+    {
+        lock.unlock();
+        writeFile();
+        lock.lock();
+        _quitCondition.wait_for(lock, _interval, [this] { return _quit; });
+    }
+
+    // Leave the final values behind
+    lock.unlock();
+    writeFile();
+}
+
+bool MetricsExporter::writeFile()
+{
+    std::string tmpPath = _filePath + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        if (!file)
+        {
+            std::cerr << "Error(MetricsExporter::writeFile): Could not open metrics file - " << tmpPath << std::endl;
+            return false;
+        }
+        file << _registry->getSnapshot();
+    }
+
+    std::error_code err;
+    std::filesystem::rename(tmpPath, _filePath, err);
+    if (err)
+    {
+        std::cerr << "Error(MetricsExporter::writeFile): Could not replace metrics file - " << _filePath << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+void MetricsExporter::serveSocketLoop()
+{
+#ifndef _WIN32
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_quitLock);
+            if (_quit)
+                break;
+        }
+
+        pollfd listenPoll = { _socketFd, POLLIN, 0 };
+        if (poll(&listenPoll, 1, METRICS_SOCKET_POLL_MS) <= 0)
+            continue;
+
+        int clientFd = accept(_socketFd, nullptr, nullptr);
+        if (clientFd < 0)
+            continue;
+
+        // Scrapers send an HTTP request first, plain readers like socat don't
+        pollfd clientPoll = { clientFd, POLLIN, 0 };
+        if (poll(&clientPoll, 1, METRICS_REQUEST_WAIT_MS) > 0)
+        {
+            char request[4096];
+            (void)recv(clientFd, request, sizeof(request), 0);
+        }
+
+        std::string body = _registry->getSnapshot();
+        std::ostringstream response;
+        response << "HTTP/1.0 200 OK\r\n"
+                 << "Content-Type: text/plain; version=0.0.4\r\n"
+                 << "Content-Length: " << body.size() << "\r\n\r\n"
+                 << body;
+        std::string data = response.str();
+        int flags(0);
+#ifdef MSG_NOSIGNAL
+        flags = MSG_NOSIGNAL;
+#endif
+        size_t sent(0);
+        while (sent < data.size())
+        {
+            ssize_t res = send(clientFd, data.data() + sent, data.size() - sent, flags);
+            if (res <= 0)
+                break;
+            sent += res;
+        }
+        close(clientFd);
+    }
+#endif
+}
@@ -0,0 +1,174 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Monotonic counter, updated without locking
+class MetricCounter
+{
+public:
+    MetricCounter()
+        : _value(0)
+    {}
+
+    void add(uint64_t value) { _value.fetch_add(value, std::memory_order_relaxed); }
+    void addDuration(std::chrono::steady_clock::duration duration)
+    {
+        add(std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+    }
+    const uint64_t get() { return _value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> _value;
+};
+
+// Latency histogram in microseconds with log-linear buckets, like an HDR histogram: each
+// power of two is split into 4 sub-buckets, giving a resolution of at worst 25% from 1us to
+// several minutes. Recording is a couple of relaxed atomic increments.
+class LatencyHistogram
+{
+public:
+    static const unsigned int SUB_BUCKET_BITS = 2;
+    static const unsigned int NUM_SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const unsigned int NUM_OCTAVES = 28;
+    static const unsigned int NUM_BUCKETS = NUM_OCTAVES * NUM_SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(std::chrono::steady_clock::duration duration);
+    void recordMicros(uint64_t micros);
+
+    const uint64_t getCount() { return _count.load(std::memory_order_relaxed); }
+    const uint64_t getSumMicros() { return _sumMicros.load(std::memory_order_relaxed); }
+    const uint64_t getBucketCount(unsigned int bucket) { return _buckets[bucket].load(std::memory_order_relaxed); }
+
+    // Largest value counted in the bucket
+    static uint64_t getBucketUpperMicros(unsigned int bucket);
+
+    // Upper bound of the bucket holding the given quantile, 0 if nothing was recorded
+    const uint64_t getQuantileMicros(double quantile);
+
+private:
+    static unsigned int getBucket(uint64_t micros);
+
+    std::atomic<uint64_t> _buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> _count;
+    std::atomic<uint64_t> _sumMicros;
+};
+
+// Records the time until it goes out of scope, does nothing without a histogram
+class ScopedLatency
+{
+public:
+    ScopedLatency(LatencyHistogram* histogram)
+        : _histogram(histogram)
+        , _start(std::chrono::steady_clock::now())
+    {}
+    ~ScopedLatency()
+    {
+        if (_histogram)
+            _histogram->record(std::chrono::steady_clock::now() - _start);
+    }
+
+private:
+    LatencyHistogram* _histogram;
+    std::chrono::steady_clock::time_point _start;
+};
+
+// Named metrics shared by the whole process. Looking a metric up takes a lock, so hot paths
+// keep the returned reference, which stays valid for the life of the registry.
+class MetricsRegistry
+{
+public:
+    MetricsRegistry() {};
+    ~MetricsRegistry() {};
+
+    // Counters holding microseconds are exported in seconds with a valueScale of 1e-6
+    MetricCounter& getCounter(const std::string& name,
+                              const std::string& help,
+                              const std::string& labels = "",
+                              double valueScale = 1.0);
+    LatencyHistogram& getHistogram(const std::string& name,
+                                   const std::string& help,
+                                   const std::string& labels = "");
+
+    // Gauges are sampled when a snapshot is taken
+    void setGauge(const std::string& name,
+                  const std::string& help,
+                  const std::string& labels,
+                  std::function<double()> sample);
+    // Once this returns the gauge is no longer sampled
+    void removeGauge(const std::string& name, const std::string& labels);
+
+    // All metrics in the Prometheus text exposition format
+    const std::string getSnapshot();
+
+private:
+    template <class T> struct MetricFamily
+    {
+        std::string help;
+        double valueScale;
+        std::map<std::string, T> metrics; // Keyed by label set
+    };
+
+    std::mutex _lock;
+    std::map<std::string, MetricFamily<std::unique_ptr<MetricCounter>>> _counters;
+    std::map<std::string, MetricFamily<std::unique_ptr<LatencyHistogram>>> _histograms;
+    std::map<std::string, MetricFamily<std::function<double()>>> _gauges;
+};
+
+// Periodically writes registry snapshots to a file, replaced atomically so a node exporter
+// textfile collector never reads a partial file, and/or serves them on a local Unix socket.
+class MetricsExporter
+{
+public:
+    MetricsExporter(std::shared_ptr<MetricsRegistry> registry,
+                    const std::string& filePath,
+                    const std::string& socketPath,
+                    std::chrono::milliseconds interval);
+    ~MetricsExporter() { stop(); }
+
+    bool start();
+    void stop();
+
+private:
+    void writeFileLoop();
+    bool writeFile();
+    void serveSocketLoop();
+
+    std::shared_ptr<MetricsRegistry> _registry;
+    std::string _filePath;
+    std::string _socketPath;
+    std::chrono::milliseconds _interval;
+    int _socketFd;
+
+    std::mutex _quitLock;
+    std::condition_variable _quitCondition;
+    bool _quit;
+    std::thread _fileThread;
+    std::thread _socketThread;
+};
@@ -0,0 +1,61 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Per pixel-format constants used by the stitch and composite paths.
+// borderValue is the fill colour warpPerspective uses outside of the warped image.
+template <typename PixelT> struct PixelTraits;
+
+template <> struct PixelTraits<uchar>
+{
+    static const int type = CV_8UC1;
+    static const int grayConversion = -1;
+    static constexpr double grayScale = 1.0;
+    static cv::Scalar borderValue() { return cv::Scalar(0); }
+};
+
+template <> struct PixelTraits<cv::Vec3b>
+{
+    static const int type = CV_8UC3;
+    static const int grayConversion = cv::COLOR_BGR2GRAY;
+    static constexpr double grayScale = 1.0;
+    static cv::Scalar borderValue() { return cv::Scalar(0, 255, 0); }
+};
+
+template <> struct PixelTraits<cv::Vec4b>
+{
+    static const int type = CV_8UC4;
+    static const int grayConversion = cv::COLOR_BGRA2GRAY;
+    static constexpr double grayScale = 1.0;
+    static cv::Scalar borderValue() { return cv::Scalar(0, 255, 0, 0); }
+};
+
+template <> struct PixelTraits<cv::Vec3w>
+{
+    static const int type = CV_16UC3;
+    static const int grayConversion = cv::COLOR_BGR2GRAY;
+    static constexpr double grayScale = 1.0 / 257.0;
+    static cv::Scalar borderValue() { return cv::Scalar(0, 65535, 0); }
+};
+
+// Returns true if the given OpenCV matrix type has a specialised stitch path
+inline bool isSupportedPixelType(int type)
+{
+    return type == CV_8UC1 || type == CV_8UC3 || type == CV_8UC4 || type == CV_16UC3;
+}
@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <thread>
+
+#include "ResultCache.hpp"
+#include "XXHash64.hpp"
+
+const uint32_t CACHE_FILE_MAGIC = 0x43525050; // "PPRC"
+const uint32_t CACHE_FORMAT_VERSION = 1;
+const std::string CACHE_FILE_EXT = ".ppc";
+
+struct CacheFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+};
+
+ResultCache::ResultCache(const std::string& cacheDir, uintmax_t maxBytes)
+    : _cacheDir(cacheDir)
+    , _maxBytes(maxBytes)
+    , _totalBytes(0)
+    , _valid(false)
+{
+    std::error_code err;
+    std::filesystem::create_directories(_cacheDir, err);
+    if (err || !std::filesystem::is_directory(_cacheDir))
+    {
+        std::cerr << "Error(ResultCache): Could not create cache directory - " << cacheDir << std::endl;
+        return;
+    }
+
+    // Rebuild the LRU order from a previous run using the entry modification times
+    std::vector<std::pair<std::filesystem::file_time_type, uint64_t>> existing;
+    for (const auto& entry : std::filesystem::directory_iterator(_cacheDir, err))
+    {
+        if (!entry.is_regular_file() || entry.path().extension() != CACHE_FILE_EXT)
+            continue;
+
+        uint64_t key(0);
+        std::istringstream keyStream(entry.path().stem().string());
+        if (!(keyStream >> std::hex >> key))
+            continue;
+
+        existing.emplace_back(entry.last_write_time(), key);
+        _entries[key].size = entry.file_size();
+        _totalBytes += _entries[key].size;
+    }
+
+    std::sort(existing.begin(), existing.end());
+    for (const auto& entry : existing)
+    {
+        _lruKeys.push_front(entry.second);
+        _entries[entry.second].lruItr = _lruKeys.begin();
+    }
+
+    evictEntries();
+    _valid = true;
+}
+
+const uint64_t ResultCache::computeKey(const std::vector<cv::Mat>& imgs, const std::string& params)
+{
+    XXHash64 hash(CACHE_FORMAT_VERSION);
+    hash.update(params.data(), params.size());
+    for (const cv::Mat& img : imgs)
+    {
+        int header[3] = { img.rows, img.cols, img.type() };
+        hash.update(header);
+
+        // Rows are hashed separately so ROIs of larger images hash the same as copies
+        size_t rowBytes = img.cols * img.elemSize();
+        for (int row = 0; row < img.rows; row++)
+            hash.update(img.ptr(row), rowBytes);
+    }
+
+    return hash.digest();
+}
+
+bool ResultCache::get(uint64_t key, cv::Mat& img)
+{
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        auto itr = _entries.find(key);
+        if (itr == _entries.end())
+            return false;
+
+        _lruKeys.splice(_lruKeys.begin(), _lruKeys, itr->second.lruItr);
+    }
+
+    std::filesystem::path entryPath = getEntryPath(key);
+    std::ifstream file(entryPath, std::ios::binary);
+    CacheFileHeader header;
+    bool valid = file && file.read(reinterpret_cast<char*>(&header), sizeof(header)) &&
+                 header.magic == CACHE_FILE_MAGIC && header.version == CACHE_FORMAT_VERSION &&
+                 header.rows > 0 && header.cols > 0;
+    if (valid)
+    {
+        cv::Mat cachedImg(header.rows, header.cols, header.type);
+        valid = static_cast<bool>(file.read(reinterpret_cast<char*>(cachedImg.data), cachedImg.total() * cachedImg.elemSize()));
+        if (valid)
+            img = std::move(cachedImg);
+    }
+
+    std::error_code err;
+    if (!valid)
+    {
+        std::cerr << "Error(ResultCache::get): Dropping unreadable cache entry - " << entryPath << std::endl;
+        file.close();
+        std::lock_guard<std::mutex> lock(_lock);
+        auto itr = _entries.find(key);
+        if (itr != _entries.end())
+        {
+            _totalBytes -= itr->second.size;
+            _lruKeys.erase(itr->second.lruItr);
+            _entries.erase(itr);
+        }
+        std::filesystem::remove(entryPath, err);
+        return false;
+    }
+
+    // Keep the on-disk order in step so the next run starts with the same LRU order
+    std::filesystem::last_write_time(entryPath, std::filesystem::file_time_type::clock::now(), err);
+    return true;
+}
+
+bool ResultCache::put(uint64_t key, const cv::Mat& img)
+{
+    if (img.empty())
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_entries.find(key) != _entries.end())
+            return true;
+    }
+
+    // Write to a temporary file first so readers never see a partial entry
+    std::filesystem::path entryPath = getEntryPath(key);
+    std::ostringstream tmpName;
+    tmpName << entryPath.string() << ".tmp" << std::this_thread::get_id();
+    std::filesystem::path tmpPath(tmpName.str());
+
+    CacheFileHeader header = { CACHE_FILE_MAGIC, CACHE_FORMAT_VERSION, img.rows, img.cols, img.type() };
+    std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    size_t rowBytes = img.cols * img.elemSize();
+    for (int row = 0; row < img.rows && file; row++)
+        file.write(reinterpret_cast<const char*>(img.ptr(row)), rowBytes);
+    file.close();
+
+    std::error_code err;
+    if (!file)
+    {
+        std::cerr << "Error(ResultCache::put): Failed to write cache entry - " << tmpPath << std::endl;
+        std::filesystem::remove(tmpPath, err);
+        return false;
+    }
+
+    std::filesystem::rename(tmpPath, entryPath, err);
+    if (err)
+    {
+        std::cerr << "Error(ResultCache::put): Failed to commit cache entry - " << entryPath << std::endl;
+        std::filesystem::remove(tmpPath, err);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    if (_entries.find(key) == _entries.end())
+    {
+        _lruKeys.push_front(key);
+        CacheEntry& entry = _entries[key];
+        entry.lruItr = _lruKeys.begin();
+        entry.size = sizeof(header) + rowBytes * img.rows;
+        _totalBytes += entry.size;
+        evictEntries();
+    }
+
+    return true;
+}
+
+std::filesystem::path ResultCache::getEntryPath(uint64_t key)
+{
+    std::ostringstream name;
+    name << std::hex << std::setw(16) << std::setfill('0') << key << CACHE_FILE_EXT;
+    return _cacheDir / name.str();
+}
+
+void ResultCache::evictEntries()
+{
+    // Must be called with _lock held
+    std::error_code err;
+    while (_totalBytes > _maxBytes && !_lruKeys.empty())
+    {
+        uint64_t key = _lruKeys.back();
+        _lruKeys.pop_back();
+
+        auto itr = _entries.find(key);
+        _totalBytes -= itr->second.size;
+        _entries.erase(itr);
+        std::filesystem::remove(getEntryPath(key), err);
+    }
+}
@@ -0,0 +1,62 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// On-disk cache of stitched images, keyed by a hash of the input image group and the
+// stitch parameters. Shared by all stitcher workers, evicts least recently used entries
+// once the total size of the cached images exceeds the size limit.
+class ResultCache
+{
+public:
+    ResultCache(const std::string& cacheDir, uintmax_t maxBytes);
+    ~ResultCache() {};
+
+    const bool isValid() { return _valid; }
+
+    const uint64_t computeKey(const std::vector<cv::Mat>& imgs, const std::string& params);
+
+    bool get(uint64_t key, cv::Mat& img);
+    bool put(uint64_t key, const cv::Mat& img);
+
+private:
+    struct CacheEntry
+    {
+        std::list<uint64_t>::iterator lruItr;
+        uintmax_t size;
+    };
+
+    std::filesystem::path getEntryPath(uint64_t key);
+    void evictEntries();
+
+    std::filesystem::path _cacheDir;
+    uintmax_t _maxBytes;
+    uintmax_t _totalBytes;
+    bool _valid;
+
+    std::mutex _lock;
+    std::list<uint64_t> _lruKeys; // Most recently used at the front
+    std::unordered_map<uint64_t, CacheEntry> _entries;
+};
@@ -0,0 +1,125 @@
+#include "RigCalibration.hpp"
+#include "XXHash64.hpp"
+
+const int CALIBRATION_FORMAT_VERSION = 1;
+
+bool RigCalibration::load(const std::string& path)
+{
+    cv::FileStorage file(path, cv::FileStorage::READ);
+    if (!file.isOpened())
+    {
+        std::cerr << "Error(RigCalibration::load): Could not open calibration file - " << path << std::endl;
+        return false;
+    }
+
+    if (static_cast<int>(file["version"]) != CALIBRATION_FORMAT_VERSION)
+    {
+        std::cerr << "Error(RigCalibration::load): Unsupported calibration version in - " << path << std::endl;
+        return false;
+    }
+
+    std::map<unsigned int, PairCalibration> pairs;
+    cv::FileNode pairNodes = file["pairs"];
+    for (size_t i = 0; i < pairNodes.size(); i++)
+    {
+        cv::FileNode pairNode = pairNodes[static_cast<int>(i)];
+        PairCalibration pair;
+        int pairId = static_cast<int>(pairNode["id"]);
+        pairNode["homography"] >> pair.homography;
+        pairNode["leftSize"] >> pair.leftSize;
+        pairNode["rightSize"] >> pair.rightSize;
+        pairNode["canvasBounds"] >> pair.canvasBounds;
+        if (!pairNode["warpMap"].empty())
+            pairNode["warpMap"] >> pair.warpMap;
+
+        if (pairId < 0 || pair.homography.rows != 3 || pair.homography.cols != 3 || pair.canvasBounds.empty())
+        {
+            std::cerr << "Error(RigCalibration::load): Invalid entry at index " << i << " in - " << path << std::endl;
+            return false;
+        }
+
+        pairs[pairId] = pair;
+    }
+
+    if (pairs.empty())
+    {
+        std::cerr << "Error(RigCalibration::load): No stitch pairs in calibration file - " << path << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(_lock);
+    _pairs = std::move(pairs);
+    return true;
+}
+
+bool RigCalibration::save(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    cv::FileStorage file(path, cv::FileStorage::WRITE);
+    if (!file.isOpened())
+    {
+        std::cerr << "Error(RigCalibration::save): Could not open calibration file - " << path << std::endl;
+        return false;
+    }
+
+    file << "version" << CALIBRATION_FORMAT_VERSION;
+    file << "pairs" << "[";
+    for (const auto& pair : _pairs)
+    {
+        file << "{";
+        file << "id" << static_cast<int>(pair.first);
+        file << "homography" << pair.second.homography;
+        file << "leftSize" << pair.second.leftSize;
+        file << "rightSize" << pair.second.rightSize;
+        file << "canvasBounds" << pair.second.canvasBounds;
+        if (!pair.second.warpMap.empty())
+            file << "warpMap" << pair.second.warpMap;
+        file << "}";
+    }
+    file << "]";
+    file.release();
+
+    return true;
+}
+
+const bool RigCalibration::empty()
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    return _pairs.empty();
+}
+
+const uint64_t RigCalibration::getSignature()
+{
+    // Warp maps are derived from the homographies, so they don't need hashing
+    std::lock_guard<std::mutex> lock(_lock);
+    XXHash64 hash(CALIBRATION_FORMAT_VERSION);
+    for (const auto& pair : _pairs)
+    {
+        cv::Mat homog;
+        pair.second.homography.convertTo(homog, CV_64F);
+        int bounds[5] = { static_cast<int>(pair.first), pair.second.canvasBounds.x, pair.second.canvasBounds.y,
+                          pair.second.canvasBounds.width, pair.second.canvasBounds.height };
+        hash.update(bounds);
+        for (int row = 0; row < homog.rows; row++)
+            hash.update(homog.ptr(row), homog.cols * homog.elemSize());
+    }
+
+    return hash.digest();
+}
+
+const bool RigCalibration::getPair(unsigned int pairId, PairCalibration& pair)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    auto itr = _pairs.find(pairId);
+    if (itr == _pairs.end())
+        return false;
+
+    pair = itr->second;
+    return true;
+}
+
+void RigCalibration::setPair(unsigned int pairId, const PairCalibration& pair)
+{
+    std::lock_guard<std::mutex> lock(_lock);
+    _pairs[pairId] = pair;
+}
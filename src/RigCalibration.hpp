@@ -0,0 +1,63 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+// Registration result for one stitch of a left and right image. Stitches are numbered
+// in the order the stitcher workers perform them: the pairs of input images first,
+// then the pairs of stitched images of each following level.
+struct PairCalibration
+{
+    cv::Mat homography;    // Maps the right image onto the left image canvas
+    cv::Size leftSize;
+    cv::Size rightSize;
+    cv::Rect canvasBounds; // Crop of the canvas kept as the stitched image
+    cv::Mat warpMap;       // Optional CV_16SC2 canvas to right image lookup table
+};
+
+// Homography chain, canvas bounds and optional warp maps of a camera rig, stored with
+// cv::FileStorage so a good registration can be reused on every following run.
+class RigCalibration
+{
+public:
+    RigCalibration()
+        : _exportClaimed(false)
+    {}
+    ~RigCalibration() {};
+
+    bool load(const std::string& path);
+    bool save(const std::string& path);
+
+    const bool empty();
+    const uint64_t getSignature();
+    const bool getPair(unsigned int pairId, PairCalibration& pair);
+    void setPair(unsigned int pairId, const PairCalibration& pair);
+
+    // Returns true for the first caller only, so a single worker exports the calibration
+    bool claimExport() { return !_exportClaimed.exchange(true); }
+
+private:
+    std::mutex _lock;
+    std::map<unsigned int, PairCalibration> _pairs;
+    std::atomic_bool _exportClaimed;
+};
@@ -0,0 +1,147 @@
+#include "ShmBridge.hpp"
+
+const std::chrono::milliseconds SHM_WORKER_CHECK_INTERVAL(500);
+
+void ShmCoordinatorBridge::start()
+{
+    _publishThread = std::thread(&ShmCoordinatorBridge::publishJobs, this);
+    _collectThread = std::thread(&ShmCoordinatorBridge::collectResults, this);
+    _reclaimThread = std::thread(&ShmCoordinatorBridge::reclaimDeadWorkerJobs, this);
+}
+
+void ShmCoordinatorBridge::stop()
+{
+    _channel.stop();
+    _jobQueue.stop();
+    if (_publishThread.joinable())
+        _publishThread.join();
+    if (_collectThread.joinable())
+        _collectThread.join();
+
+    {
+        std::lock_guard<std::mutex> lock(_quitLock);
+        _quit = true;
+    }
+    _quitCondition.notify_all();
+    if (_reclaimThread.joinable())
+        _reclaimThread.join();
+}
+
+void ShmCoordinatorBridge::publishJobs()
+{
+    while (!_channel.isStopped())
+    {
+        StitchJob job(std::move(_jobQueue.pop()));
+        if (job.imgs.empty())
+        {
+            if (_jobQueue.isStopped())
+                break;
+            continue;
+        }
+
+        if (!_channel.pushJob(job))
+        {
+            std::cerr << "Error(publishJobs): Failed to publish job - " << job.id << std::endl;
+            ResIdPair failed(job.id, cv::Mat());
+            _resQueue.push(failed);
+        }
+    }
+}
+
+void ShmCoordinatorBridge::collectResults()
+{
+    ResIdPair res;
+    while (_channel.popResult(res))
+        _resQueue.push(res);
+}
+
+void ShmCoordinatorBridge::reclaimDeadWorkerJobs()
+{
+    std::unique_lock<std::mutex> lock(_quitLock);
+    while (!_quit)
+    {
+        _quitCondition.wait_for(lock, SHM_WORKER_CHECK_INTERVAL);
+        if (_quit)
+            break;
+
+        // Results of lost jobs would never arrive, so the ordered delivery would wait for them forever
+        std::vector<unsigned int> lostJobIds;
+        _channel.reclaimDeadWorkerJobs(lostJobIds);
+        for (unsigned int jobId : lostJobIds)
+        {
+            ResIdPair failed(jobId, cv::Mat());
+            _resQueue.push(failed);
+        }
+    }
+}
+
+void ShmWorkerBridge::start()
+{
+    _fetchThread = std::thread(&ShmWorkerBridge::fetchJobs, this);
+    _returnThread = std::thread(&ShmWorkerBridge::returnResults, this);
+}
+
+void ShmWorkerBridge::stop()
+{
+    _channel.stop();
+    _resQueue.stop();
+    _jobDoneCondition.notify_all();
+    wait();
+}
+
+void ShmWorkerBridge::wait()
+{
+    if (_fetchThread.joinable())
+        _fetchThread.join();
+
+    // Results are only returned while the channel is up
+    _resQueue.stop();
+    if (_returnThread.joinable())
+        _returnThread.join();
+}
+
+void ShmWorkerBridge::fetchJobs()
+{
+    while (!_channel.isStopped())
+    {
+        {
+            std::unique_lock<std::mutex> lock(_inFlightLock);
+            while (_numJobsInFlight >= _maxJobsInFlight && !_channel.isStopped())
+                _jobDoneCondition.wait(lock);
+        }
+
+        StitchJob job;
+        if (!_channel.popJob(job))
+            break;
+
+        {
+            std::lock_guard<std::mutex> lock(_inFlightLock);
+            ++_numJobsInFlight;
+        }
+        _jobQueue.push(job);
+    }
+}
+
+void ShmWorkerBridge::returnResults()
+{
+    while (true)
+    {
+        // Failed jobs have an empty result, only the stop value has no id
+        ResIdPair res(std::move(_resQueue.pop()));
+        if (res.first == 0)
+        {
+            if (_resQueue.isStopped())
+                break;
+            continue;
+        }
+
+        // The job images stay in their frame slots until the result is out
+        if (!_channel.pushResult(res))
+            std::cerr << "Error(returnResults): Failed to return result - " << res.first << std::endl;
+        _channel.releaseJob(res.first);
+
+        std::lock_guard<std::mutex> lock(_inFlightLock);
+        --_numJobsInFlight;
+        _jobDoneCondition.notify_all();
+    }
+}
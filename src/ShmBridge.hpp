@@ -0,0 +1,98 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "ShmChannel.hpp"
+#include "StitcherWorker.hpp"
+#include "ThreadSafeDequeue.hpp"
+
+// Coordinator side: publishes jobs from a local queue to the shared memory channel and
+// collects the results of every worker process into the local result queue. Jobs held by a
+// worker process that dies are delivered as failed, so they do not hold back the others.
+class ShmCoordinatorBridge
+{
+public:
+    ShmCoordinatorBridge(ShmChannel& channel,
+                         ThreadSafeDequeue<StitchJob>& jobQueue,
+                         ThreadSafeDequeue<ResIdPair>& resQueue)
+        : _channel(channel)
+        , _jobQueue(jobQueue)
+        , _resQueue(resQueue)
+        , _quit(false)
+    {}
+    ~ShmCoordinatorBridge() { stop(); }
+
+    void start();
+    void stop();
+
+private:
+    void publishJobs();
+    void collectResults();
+    void reclaimDeadWorkerJobs();
+
+    ShmChannel& _channel;
+    ThreadSafeDequeue<StitchJob>& _jobQueue;
+    ThreadSafeDequeue<ResIdPair>& _resQueue;
+    std::thread _publishThread;
+    std::thread _collectThread;
+    std::thread _reclaimThread;
+    std::mutex _quitLock;
+    std::condition_variable _quitCondition;
+    bool _quit;
+};
+
+// Worker side: takes jobs from the shared memory channel only while a local stitcher
+// worker is free, so jobs stay available to the other processes, and returns the results.
+class ShmWorkerBridge
+{
+public:
+    ShmWorkerBridge(ShmChannel& channel,
+                    ThreadSafeDequeue<StitchJob>& jobQueue,
+                    ThreadSafeDequeue<ResIdPair>& resQueue,
+                    unsigned int maxJobsInFlight)
+        : _channel(channel)
+        , _jobQueue(jobQueue)
+        , _resQueue(resQueue)
+        , _maxJobsInFlight(maxJobsInFlight)
+        , _numJobsInFlight(0)
+    {}
+    ~ShmWorkerBridge() { stop(); }
+
+    void start();
+    void stop();
+
+    // Blocks until the coordinator stops the channel
+    void wait();
+
+private:
+    void fetchJobs();
+    void returnResults();
+
+    ShmChannel& _channel;
+    ThreadSafeDequeue<StitchJob>& _jobQueue;
+    ThreadSafeDequeue<ResIdPair>& _resQueue;
+    unsigned int _maxJobsInFlight;
+    unsigned int _numJobsInFlight;
+    std::mutex _inFlightLock;
+    std::condition_variable _jobDoneCondition;
+    std::thread _fetchThread;
+    std::thread _returnThread;
+};
@@ -0,0 +1,613 @@
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShmChannel.hpp"
+
+const uint32_t SHM_CHANNEL_MAGIC = 0x50505348; // "PPSH"
+const uint32_t SHM_CHANNEL_VERSION = 5;
+const int SHM_ATTACH_RETRIES = 50;
+const std::chrono::milliseconds SHM_ATTACH_RETRY_DELAY(100);
+
+bool isProcessGone(int32_t pid)
+{
+    return kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+// Gives a result slot back to the pool when the last Mat referencing it is released. A closed
+// channel leaves the region mapped until then, and the allocator unmaps it with the last result.
+class ShmResultAllocator : public cv::MatAllocator
+{
+public:
+    ShmResultAllocator(const ShmSlabPool& pool, uint32_t maxHeld)
+        : _pool(pool)
+        , _maxHeld(maxHeld)
+        , _numHeld(0)
+        , _region(nullptr)
+        , _regionSize(0)
+        , _released(false)
+    {}
+
+    // Returns false if too many slots are held already
+    bool wrap(const ShmFrameDesc& desc, cv::Mat& img)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            if (_numHeld >= _maxHeld)
+                return false;
+            ++_numHeld;
+        }
+
+        unsigned char* data = _pool.getSlotData(desc.slot);
+        img = cv::Mat(desc.rows, desc.cols, desc.type, data);
+        cv::UMatData* u = new cv::UMatData(this);
+        u->data = u->origdata = data;
+        u->size = img.total() * img.elemSize();
+        img.u = u;
+        img.allocator = this;
+        img.addref();
+        return true;
+    }
+
+    void release(void* region, size_t regionSize)
+    {
+        bool unused = false;
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _region = region;
+            _regionSize = regionSize;
+            _released = true;
+            unused = _numHeld == 0;
+        }
+
+        if (unused)
+        {
+            munmap(region, regionSize);
+            delete this;
+        }
+    }
+
+    // Images made from a result, like a resize in place, get ordinary memory
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usageFlags);
+    }
+
+    bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override
+    {
+        return cv::Mat::getStdAllocator()->allocate(data, accessFlags, usageFlags);
+    }
+
+    void deallocate(cv::UMatData* data) const override
+    {
+        if (!data)
+            return;
+
+        _pool.free(_pool.getSlot(data->origdata));
+        delete data;
+
+        bool unused = false;
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            --_numHeld;
+            unused = _released && _numHeld == 0;
+        }
+
+        if (unused)
+        {
+            munmap(_region, _regionSize);
+            delete this;
+        }
+    }
+
+private:
+    ~ShmResultAllocator() {}
+
+    mutable ShmSlabPool _pool; // Only refers to the shared memory, so a copy outlives the channel
+    uint32_t _maxHeld;
+    mutable std::mutex _lock;
+    mutable uint32_t _numHeld;
+    void* _region;
+    size_t _regionSize;
+    bool _released;
+};
+
+size_t ShmSlabPool::getRequiredSize(size_t slotBytes, uint32_t numSlots)
+{
+    return shmAlignUp(sizeof(Header)) + shmAlignUp(sizeof(int32_t) * numSlots) + shmAlignUp(slotBytes) * numSlots;
+}
+
+void ShmSlabPool::create(void* mem, size_t slotBytes, uint32_t numSlots)
+{
+    _header = static_cast<Header*>(mem);
+    initSharedMutex(&_header->lock);
+    initSharedCondition(&_header->slotFreedCondition);
+    _header->slotBytes = shmAlignUp(slotBytes);
+    _header->numSlots = numSlots;
+    _header->numFree = numSlots;
+    _header->quit = 0;
+    attach(mem);
+
+    for (uint32_t i = 0; i < numSlots; i++)
+        _freeSlots[i] = i;
+}
+
+void ShmSlabPool::attach(void* mem)
+{
+    _header = static_cast<Header*>(mem);
+    char* base = static_cast<char*>(mem);
+    _freeSlots = reinterpret_cast<int32_t*>(base + shmAlignUp(sizeof(Header)));
+    _data = reinterpret_cast<unsigned char*>(base + shmAlignUp(sizeof(Header)) +
+                                             shmAlignUp(sizeof(int32_t) * _header->numSlots));
+}
+
+int32_t ShmSlabPool::alloc()
+{
+    SharedMutexLock lock(&_header->lock);
+    while (_header->numFree == 0 && !_header->quit)
+        lock.wait(&_header->slotFreedCondition);
+    if (_header->quit)
+        return -1;
+
+    return _freeSlots[--_header->numFree];
+}
+
+void ShmSlabPool::free(int32_t slot)
+{
+    SharedMutexLock lock(&_header->lock);
+    _freeSlots[_header->numFree++] = slot;
+    pthread_cond_signal(&_header->slotFreedCondition);
+}
+
+void ShmSlabPool::stop()
+{
+    SharedMutexLock lock(&_header->lock);
+    _header->quit = 1;
+    pthread_cond_broadcast(&_header->slotFreedCondition);
+}
+
+ShmChannel::ShmChannel()
+    : _owner(false)
+    , _region(nullptr)
+    , _regionSize(0)
+    , _header(nullptr)
+    , _resultAllocator(nullptr)
+    , _inFlightTable(nullptr)
+    , _inFlightJobs(nullptr)
+{}
+
+ShmChannel::~ShmChannel()
+{
+    close();
+}
+
+bool ShmChannel::create(const std::string& name,
+                        size_t frameSlotBytes,
+                        uint32_t framesPerJob,
+                        size_t resultSlotBytes,
+                        uint32_t jobCapacity,
+                        float outputScale,
+                        int32_t registrationScale)
+{
+    if (framesPerJob == 0 || framesPerJob > SHM_MAX_FRAMES_PER_JOB || jobCapacity == 0)
+    {
+        std::cerr << "Error(ShmChannel::create): Invalid number of frames per job or job capacity." << std::endl;
+        return false;
+    }
+
+    _name = name.front() == '/' ? name : "/" + name;
+
+    // Enough frame slots for every job in flight, each in flight job also needs a result slot
+    uint32_t numFrameSlots = framesPerJob * jobCapacity;
+    uint64_t jobQueueOffset = shmAlignUp(sizeof(ChannelHeader));
+    uint64_t resultQueueOffset = jobQueueOffset + ShmDequeue<ShmJobEntry>::getRequiredSize(jobCapacity);
+    uint64_t framePoolOffset = resultQueueOffset + ShmDequeue<ShmResultEntry>::getRequiredSize(jobCapacity);
+    uint64_t resultPoolOffset = framePoolOffset + ShmSlabPool::getRequiredSize(frameSlotBytes, numFrameSlots);
+    uint64_t inFlightOffset = resultPoolOffset + ShmSlabPool::getRequiredSize(resultSlotBytes, jobCapacity);
+    size_t regionSize = inFlightOffset + getInFlightTableSize(numFrameSlots);
+
+    // Only replace a channel left behind by a coordinator that is gone, never a live one
+    int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    int openError = errno;
+    if (fd < 0 && openError == EEXIST && removeStaleChannel())
+    {
+        fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        openError = errno;
+    }
+    if (fd < 0)
+    {
+        if (openError == EEXIST)
+            std::cerr << "Error(ShmChannel::create): Shared memory channel " << _name << " is used by a running coordinator,"
+                      << " or was left by another version (remove /dev/shm" << _name << ")." << std::endl;
+        else
+            std::cerr << "Error(ShmChannel::create): Failed to create shared memory - " << _name << std::endl;
+        return false;
+    }
+
+    if (ftruncate(fd, regionSize) != 0)
+    {
+        std::cerr << "Error(ShmChannel::create): Failed to size shared memory to " << regionSize << " bytes." << std::endl;
+        ::close(fd);
+        shm_unlink(_name.c_str());
+        return false;
+    }
+
+    _region = mmap(nullptr, regionSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (_region == MAP_FAILED)
+    {
+        std::cerr << "Error(ShmChannel::create): Failed to map shared memory - " << _name << std::endl;
+        _region = nullptr;
+        shm_unlink(_name.c_str());
+        return false;
+    }
+    _regionSize = regionSize;
+    _owner = true;
+
+    char* base = static_cast<char*>(_region);
+    _header = reinterpret_cast<ChannelHeader*>(base);
+    _header->version = SHM_CHANNEL_VERSION;
+    _header->regionSize = regionSize;
+    _header->jobQueueOffset = jobQueueOffset;
+    _header->resultQueueOffset = resultQueueOffset;
+    _header->framePoolOffset = framePoolOffset;
+    _header->resultPoolOffset = resultPoolOffset;
+    _header->inFlightOffset = inFlightOffset;
+    _header->outputScale = outputScale;
+    _header->registrationScale = registrationScale;
+    _header->ownerPid = getpid();
+    _jobQueue.create(base + jobQueueOffset, jobCapacity);
+    _resultQueue.create(base + resultQueueOffset, jobCapacity);
+    _framePool.create(base + framePoolOffset, frameSlotBytes, numFrameSlots);
+    _resultPool.create(base + resultPoolOffset, resultSlotBytes, jobCapacity);
+    _resultAllocator = new ShmResultAllocator(_resultPool, jobCapacity - 1);
+
+    // Every popped job holds at least one frame slot, so there is an entry for each
+    _inFlightTable = reinterpret_cast<InFlightTable*>(base + inFlightOffset);
+    _inFlightJobs = reinterpret_cast<InFlightJob*>(base + inFlightOffset + shmAlignUp(sizeof(InFlightTable)));
+    initSharedMutex(&_inFlightTable->lock);
+    _inFlightTable->capacity = numFrameSlots;
+    std::memset(_inFlightJobs, 0, sizeof(InFlightJob) * numFrameSlots);
+
+    // Workers wait for the magic value before touching anything else
+    std::atomic_thread_fence(std::memory_order_release);
+    reinterpret_cast<std::atomic<uint32_t>*>(&_header->magic)->store(SHM_CHANNEL_MAGIC, std::memory_order_release);
+    return true;
+}
+
+bool ShmChannel::removeStaleChannel()
+{
+    int fd = shm_open(_name.c_str(), O_RDONLY, 0600);
+    if (fd < 0)
+        return errno == ENOENT;
+
+    // Channels that are not fully set up, or of another version, are never taken for stale
+    bool stale(false);
+    struct stat info;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(ChannelHeader))
+    {
+        void* region = mmap(nullptr, sizeof(ChannelHeader), PROT_READ, MAP_SHARED, fd, 0);
+        if (region != MAP_FAILED)
+        {
+            ChannelHeader* header = static_cast<ChannelHeader*>(region);
+            uint32_t magic = reinterpret_cast<std::atomic<uint32_t>*>(&header->magic)->load(std::memory_order_acquire);
+            stale = magic == SHM_CHANNEL_MAGIC && header->version == SHM_CHANNEL_VERSION && header->ownerPid > 0 &&
+                    isProcessGone(header->ownerPid);
+            munmap(region, sizeof(ChannelHeader));
+        }
+    }
+    ::close(fd);
+
+    if (!stale)
+        return false;
+
+    std::cout << "Removing stale shared memory channel - " << _name << std::endl;
+    return shm_unlink(_name.c_str()) == 0 || errno == ENOENT;
+}
+
+bool ShmChannel::attach(const std::string& name)
+{
+    _name = name.front() == '/' ? name : "/" + name;
+
+    // The coordinator may still be setting the channel up
+    for (int attempt = 0; attempt < SHM_ATTACH_RETRIES; attempt++)
+    {
+        if (attempt > 0)
+            std::this_thread::sleep_for(SHM_ATTACH_RETRY_DELAY);
+
+        int fd = shm_open(_name.c_str(), O_RDWR, 0600);
+        if (fd < 0)
+            continue;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(ChannelHeader))
+        {
+            ::close(fd);
+            continue;
+        }
+
+        void* region = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (region == MAP_FAILED)
+            continue;
+
+        ChannelHeader* header = static_cast<ChannelHeader*>(region);
+        uint32_t magic = reinterpret_cast<std::atomic<uint32_t>*>(&header->magic)->load(std::memory_order_acquire);
+        if (magic != SHM_CHANNEL_MAGIC || header->version != SHM_CHANNEL_VERSION ||
+            header->regionSize != static_cast<uint64_t>(info.st_size))
+        {
+            munmap(region, info.st_size);
+            continue;
+        }
+
+        _region = region;
+        _regionSize = info.st_size;
+        _header = header;
+        _owner = false;
+
+        char* base = static_cast<char*>(_region);
+        _jobQueue.attach(base + _header->jobQueueOffset);
+        _resultQueue.attach(base + _header->resultQueueOffset);
+        _framePool.attach(base + _header->framePoolOffset);
+        _resultPool.attach(base + _header->resultPoolOffset);
+        _resultAllocator = new ShmResultAllocator(_resultPool, _resultPool.getNumSlots() - 1);
+        _inFlightTable = reinterpret_cast<InFlightTable*>(base + _header->inFlightOffset);
+        _inFlightJobs = reinterpret_cast<InFlightJob*>(base + _header->inFlightOffset + shmAlignUp(sizeof(InFlightTable)));
+        return true;
+    }
+
+    std::cerr << "Error(ShmChannel::attach): Could not attach to shared memory - " << _name << std::endl;
+    return false;
+}
+
+void ShmChannel::close()
+{
+    if (!_region)
+        return;
+
+    // Results still held keep the region mapped
+    _resultAllocator->release(_region, _regionSize);
+    _resultAllocator = nullptr;
+    if (_owner)
+        shm_unlink(_name.c_str());
+
+    _region = nullptr;
+    _header = nullptr;
+    _inFlightTable = nullptr;
+    _inFlightJobs = nullptr;
+    _owner = false;
+}
+
+void ShmChannel::stop()
+{
+    if (!_region)
+        return;
+
+    _jobQueue.stop();
+    _resultQueue.stop();
+    _framePool.stop();
+    _resultPool.stop();
+}
+
+const bool ShmChannel::isStopped()
+{
+    return !_region || _jobQueue.isStopped();
+}
+
+const float ShmChannel::getOutputScale()
+{
+    return _header ? _header->outputScale : 1.0;
+}
+
+const int ShmChannel::getRegistrationScale()
+{
+    return _header ? _header->registrationScale : 1;
+}
+
+bool ShmChannel::pushJob(const StitchJob& job)
+{
+    if (job.imgs.size() + job.regImgs.size() > SHM_MAX_FRAMES_PER_JOB)
+    {
+        std::cerr << "Error(ShmChannel::pushJob): Too many images in job - " << job.id << std::endl;
+        return false;
+    }
+
+    ShmJobEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.id = job.id;
+    entry.numFrames = job.imgs.size();
+    entry.numRegFrames = job.regImgs.size();
+    for (uint32_t i = 0; i < entry.numFrames + entry.numRegFrames; i++)
+    {
+        // Images added without a registration copy have an empty one, which takes no slot
+        const cv::Mat& img = i < entry.numFrames ? job.imgs[i] : job.regImgs[i - entry.numFrames];
+        entry.frames[i].slot = -1;
+        if (img.empty() && i >= entry.numFrames)
+            continue;
+
+        if (!storeFrame(_framePool, img, entry.frames[i]))
+        {
+            freeFrames(entry, i);
+            return false;
+        }
+    }
+
+    // A stopped queue takes no more jobs
+    if (!_jobQueue.push(entry))
+    {
+        freeFrames(entry, entry.numFrames + entry.numRegFrames);
+        return false;
+    }
+    return true;
+}
+
+void ShmChannel::freeFrames(const ShmJobEntry& entry, uint32_t numFrames)
+{
+    for (uint32_t i = 0; i < numFrames; i++)
+    {
+        if (entry.frames[i].slot >= 0)
+            _framePool.free(entry.frames[i].slot);
+    }
+}
+
+bool ShmChannel::popJob(StitchJob& job)
+{
+    // Tracked before the queue lets go of it, so a worker process dying at any point leaves it reclaimable
+    ShmJobEntry entry = _jobQueue.pop([this](const ShmJobEntry& popped) { trackJob(popped); });
+    if (entry.id == 0)
+        return false;
+
+    job.id = entry.id;
+    job.imgs.clear();
+    job.regImgs.clear();
+    for (uint32_t i = 0; i < entry.numFrames + entry.numRegFrames; i++)
+    {
+        std::vector<cv::Mat>& imgs = i < entry.numFrames ? job.imgs : job.regImgs;
+        imgs.push_back(entry.frames[i].slot < 0 ? cv::Mat() : getFrame(_framePool, entry.frames[i]));
+    }
+    return true;
+}
+
+void ShmChannel::releaseJob(unsigned int jobId)
+{
+    int32_t pid = getpid();
+    SharedMutexLock lock(&_inFlightTable->lock);
+    for (uint32_t i = 0; i < _inFlightTable->capacity; i++)
+    {
+        InFlightJob& inFlight = _inFlightJobs[i];
+        if (inFlight.ownerPid == pid && inFlight.job.id == jobId)
+        {
+            freeFrames(inFlight.job, inFlight.job.numFrames + inFlight.job.numRegFrames);
+            inFlight.ownerPid = 0;
+            return;
+        }
+    }
+}
+
+void ShmChannel::reclaimDeadWorkerJobs(std::vector<unsigned int>& lostJobIds)
+{
+    SharedMutexLock lock(&_inFlightTable->lock);
+    for (uint32_t i = 0; i < _inFlightTable->capacity; i++)
+    {
+        InFlightJob& inFlight = _inFlightJobs[i];
+        if (inFlight.ownerPid <= 0 || !isProcessGone(inFlight.ownerPid))
+            continue;
+
+        std::cerr << "Error(ShmChannel::reclaimDeadWorkerJobs): Worker process " << inFlight.ownerPid
+                  << " died holding job - " << inFlight.job.id << std::endl;
+        freeFrames(inFlight.job, inFlight.job.numFrames + inFlight.job.numRegFrames);
+        if (!inFlight.resultPushed)
+            lostJobIds.push_back(inFlight.job.id);
+        inFlight.ownerPid = 0;
+    }
+}
+
+size_t ShmChannel::getInFlightTableSize(uint32_t capacity)
+{
+    return shmAlignUp(sizeof(InFlightTable)) + shmAlignUp(sizeof(InFlightJob) * capacity);
+}
+
+void ShmChannel::trackJob(const ShmJobEntry& entry)
+{
+    SharedMutexLock lock(&_inFlightTable->lock);
+    for (uint32_t i = 0; i < _inFlightTable->capacity; i++)
+    {
+        InFlightJob& inFlight = _inFlightJobs[i];
+        if (inFlight.ownerPid == 0)
+        {
+            inFlight.ownerPid = getpid();
+            inFlight.resultPushed = 0;
+            inFlight.job = entry;
+            return;
+        }
+    }
+}
+
+void ShmChannel::markResultPushed(unsigned int jobId)
+{
+    int32_t pid = getpid();
+    SharedMutexLock lock(&_inFlightTable->lock);
+    for (uint32_t i = 0; i < _inFlightTable->capacity; i++)
+    {
+        if (_inFlightJobs[i].ownerPid == pid && _inFlightJobs[i].job.id == jobId)
+        {
+            _inFlightJobs[i].resultPushed = 1;
+            return;
+        }
+    }
+}
+
+bool ShmChannel::pushResult(const ResIdPair& res)
+{
+    ShmResultEntry entry;
+    std::memset(&entry, 0, sizeof(entry));
+    entry.id = res.first;
+    entry.frame.slot = -1;
+
+    // The coordinator still hears of failed and oversized results, as empty ones
+    bool stored = res.second.empty() || storeFrame(_resultPool, res.second, entry.frame);
+    if (!stored)
+        entry.frame.slot = -1;
+
+    // Once the result is queued a dying worker only leaves frame slots behind, not a lost job
+    if (!_resultQueue.push(entry, [this, &res] { markResultPushed(res.first); }))
+    {
+        if (entry.frame.slot >= 0)
+            _resultPool.free(entry.frame.slot);
+        return false;
+    }
+    return stored;
+}
+
+bool ShmChannel::popResult(ResIdPair& res)
+{
+    ShmResultEntry entry = _resultQueue.pop();
+    if (entry.id == 0)
+        return false;
+
+    // Results are handed over without a copy. If the consumers hold on to all but one slot, copies keep
+    // a slot free for the result the ordered delivery may still be waiting for.
+    res.first = entry.id;
+    res.second = cv::Mat();
+    if (entry.frame.slot >= 0 && !_resultAllocator->wrap(entry.frame, res.second))
+    {
+        res.second = getFrame(_resultPool, entry.frame).clone();
+        _resultPool.free(entry.frame.slot);
+    }
+    return true;
+}
+
+bool ShmChannel::storeFrame(ShmSlabPool& pool, const cv::Mat& img, ShmFrameDesc& desc)
+{
+    size_t rowBytes = img.cols * img.elemSize();
+    if (img.empty() || rowBytes * img.rows > pool.getSlotBytes())
+    {
+        std::cerr << "Error(ShmChannel::storeFrame): Image of " << rowBytes * img.rows
+                  << " bytes does not fit in a " << pool.getSlotBytes() << " byte slot." << std::endl;
+        return false;
+    }
+
+    desc.slot = pool.alloc();
+    if (desc.slot < 0)
+        return false;
+
+    desc.rows = img.rows;
+    desc.cols = img.cols;
+    desc.type = img.type();
+    cv::Mat slotImg(img.rows, img.cols, img.type(), pool.getSlotData(desc.slot));
+    img.copyTo(slotImg);
+    return true;
+}
+
+cv::Mat ShmChannel::getFrame(ShmSlabPool& pool, const ShmFrameDesc& desc)
+{
+    return cv::Mat(desc.rows, desc.cols, desc.type, pool.getSlotData(desc.slot));
+}
@@ -0,0 +1,187 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "ShmDequeue.hpp"
+#include "StitcherWorker.hpp"
+
+const unsigned int SHM_MAX_FRAMES_PER_JOB = 64;
+
+// Location of an image stored in a shared memory slab slot
+struct ShmFrameDesc
+{
+    int32_t slot;
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+};
+
+// The images of a job, followed by its reduced registration images
+struct ShmJobEntry
+{
+    uint32_t id;
+    uint32_t numFrames;
+    uint32_t numRegFrames;
+    ShmFrameDesc frames[SHM_MAX_FRAMES_PER_JOB];
+};
+
+struct ShmResultEntry
+{
+    uint32_t id;
+    ShmFrameDesc frame;
+};
+
+// Fixed size slots of image memory in shared memory, handed out from a free list
+class ShmSlabPool
+{
+public:
+    ShmSlabPool()
+        : _header(nullptr)
+        , _freeSlots(nullptr)
+        , _data(nullptr)
+    {}
+
+    static size_t getRequiredSize(size_t slotBytes, uint32_t numSlots);
+
+    void create(void* mem, size_t slotBytes, uint32_t numSlots);
+    void attach(void* mem);
+
+    // Blocks until a slot is free, returns -1 if the pool was stopped
+    int32_t alloc();
+    void free(int32_t slot);
+    void stop();
+
+    const size_t getSlotBytes() { return _header->slotBytes; }
+    const uint32_t getNumSlots() { return _header->numSlots; }
+    unsigned char* getSlotData(int32_t slot) { return _data + slot * _header->slotBytes; }
+    const int32_t getSlot(const unsigned char* data) { return (data - _data) / _header->slotBytes; }
+
+private:
+    struct Header
+    {
+        pthread_mutex_t lock;
+        pthread_cond_t slotFreedCondition;
+        uint64_t slotBytes;
+        uint32_t numSlots;
+        uint32_t numFree;
+        uint32_t quit;
+    };
+
+    Header* _header;
+    int32_t* _freeSlots;
+    unsigned char* _data;
+};
+
+class ShmResultAllocator;
+
+// Job and result queues plus the slabs holding their image pixels, in a POSIX shared
+// memory region. The coordinator process creates the channel, worker processes attach to it.
+class ShmChannel
+{
+public:
+    ShmChannel();
+    ~ShmChannel();
+
+    bool create(const std::string& name,
+                size_t frameSlotBytes,
+                uint32_t framesPerJob,
+                size_t resultSlotBytes,
+                uint32_t jobCapacity,
+                float outputScale,
+                int32_t registrationScale);
+    bool attach(const std::string& name);
+    void close();
+
+    void stop();
+    const bool isStopped();
+    const float getOutputScale();
+    const int getRegistrationScale();
+
+    // Copies the job images into frame slots, blocks until enough slots are free
+    bool pushJob(const StitchJob& job);
+
+    // Job images reference the frame slots directly, until the job is released
+    bool popJob(StitchJob& job);
+    void releaseJob(unsigned int jobId);
+
+    // Frees the frame slots of jobs taken by worker processes that have died since, and gives the
+    // ids of the jobs among them that never returned a result
+    void reclaimDeadWorkerJobs(std::vector<unsigned int>& lostJobIds);
+
+    bool pushResult(const ResIdPair& res);
+    // Result images reference their result slot until the last copy of them is released,
+    // unless all but one slot are held that way, then they are copied out
+    bool popResult(ResIdPair& res);
+
+private:
+    struct ChannelHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t regionSize;
+        uint64_t jobQueueOffset;
+        uint64_t resultQueueOffset;
+        uint64_t framePoolOffset;
+        uint64_t resultPoolOffset;
+        uint64_t inFlightOffset;
+        float outputScale;
+        int32_t registrationScale;
+        int32_t ownerPid; // Coordinator process, a channel whose owner is gone can be replaced
+    };
+
+    // Jobs popped from the queue and not released yet, with the process that popped them
+    struct InFlightJob
+    {
+        int32_t ownerPid; // 0 for a free entry
+        uint32_t resultPushed;
+        ShmJobEntry job;
+    };
+
+    struct InFlightTable
+    {
+        pthread_mutex_t lock;
+        uint32_t capacity;
+    };
+
+    static size_t getInFlightTableSize(uint32_t capacity);
+    void trackJob(const ShmJobEntry& entry);
+    void markResultPushed(unsigned int jobId);
+
+    bool removeStaleChannel();
+    bool storeFrame(ShmSlabPool& pool, const cv::Mat& img, ShmFrameDesc& desc);
+    void freeFrames(const ShmJobEntry& entry, uint32_t numFrames);
+    cv::Mat getFrame(ShmSlabPool& pool, const ShmFrameDesc& desc);
+
+    std::string _name;
+    bool _owner;
+    void* _region;
+    size_t _regionSize;
+    ChannelHeader* _header;
+    ShmDequeue<ShmJobEntry> _jobQueue;
+    ShmDequeue<ShmResultEntry> _resultQueue;
+    ShmSlabPool _framePool;
+    ShmSlabPool _resultPool;
+    ShmResultAllocator* _resultAllocator; // Released, not deleted, since results may outlive the channel
+    InFlightTable* _inFlightTable;
+    InFlightJob* _inFlightJobs;
+};
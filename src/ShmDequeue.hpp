@@ -0,0 +1,202 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <pthread.h>
+
+const size_t SHM_ALIGNMENT = 64;
+
+inline size_t shmAlignUp(size_t size)
+{
+    return (size + SHM_ALIGNMENT - 1) & ~(SHM_ALIGNMENT - 1);
+}
+
+inline void initSharedMutex(pthread_mutex_t* mutex)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+#if defined(__linux__)
+    // Lets the other processes recover the lock if a worker process dies holding it
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+#endif
+    pthread_mutex_init(mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+inline void initSharedCondition(pthread_cond_t* cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Scoped lock of a process-shared mutex
+class SharedMutexLock
+{
+public:
+    SharedMutexLock(pthread_mutex_t* mutex)
+        : _mutex(mutex)
+    {
+        int res = pthread_mutex_lock(_mutex);
+#if defined(__linux__)
+        if (res == EOWNERDEAD)
+            pthread_mutex_consistent(_mutex);
+#else
+        (void)res;
+#endif
+    }
+    ~SharedMutexLock() { pthread_mutex_unlock(_mutex); }
+
+    void wait(pthread_cond_t* cond)
+    {
+        int res = pthread_cond_wait(cond, _mutex);
+#if defined(__linux__)
+        if (res == EOWNERDEAD)
+            pthread_mutex_consistent(_mutex);
+#else
+        (void)res;
+#endif
+    }
+
+private:
+    pthread_mutex_t* _mutex;
+};
+
+// Bounded queue living in a block of shared memory so it can be used by several processes.
+// Mirrors ThreadSafeDequeue, but elements are copied in and out of the ring.
+template <class T> class ShmDequeue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "ShmDequeue elements must be trivially copyable");
+
+public:
+    ShmDequeue()
+        : _header(nullptr)
+        , _elements(nullptr)
+    {}
+
+    static size_t getRequiredSize(uint32_t capacity)
+    {
+        return shmAlignUp(sizeof(Header)) + shmAlignUp(sizeof(T) * capacity);
+    }
+
+    // Initialise the queue in the given memory, only done by the process that owns it
+    void create(void* mem, uint32_t capacity)
+    {
+        attach(mem);
+        initSharedMutex(&_header->lock);
+        initSharedCondition(&_header->notEmptyCondition);
+        initSharedCondition(&_header->notFullCondition);
+        _header->capacity = capacity;
+        _header->head = 0;
+        _header->numElements = 0;
+        _header->quit = 0;
+    }
+
+    void attach(void* mem)
+    {
+        _header = static_cast<Header*>(mem);
+        _elements = reinterpret_cast<T*>(static_cast<char*>(mem) + shmAlignUp(sizeof(Header)));
+    }
+
+    // Blocks while the queue is full, returns false if the queue was stopped
+    bool push(const T& t)
+    {
+        return push(t, [] {});
+    }
+
+    // onPushed runs under the queue lock, so a process dying right after the push leaves no gap
+    // between the element being queued and the bookkeeping that goes with it
+    template <class F> bool push(const T& t, F onPushed)
+    {
+        SharedMutexLock lock(&_header->lock);
+        while (_header->numElements == _header->capacity && !_header->quit)
+            lock.wait(&_header->notFullCondition);
+        if (_header->quit)
+            return false;
+
+        _elements[(_header->head + _header->numElements) % _header->capacity] = t;
+        ++_header->numElements;
+        onPushed();
+        pthread_cond_signal(&_header->notEmptyCondition);
+        return true;
+    }
+
+    // Blocks while the queue is empty, returns a value-initialised element if the queue was stopped
+    T pop()
+    {
+        return pop([](const T&) {});
+    }
+
+    // onPopped runs under the queue lock, like onPushed
+    template <class F> T pop(F onPopped)
+    {
+        SharedMutexLock lock(&_header->lock);
+        while (_header->numElements == 0 && !_header->quit)
+            lock.wait(&_header->notEmptyCondition);
+        if (_header->quit)
+            return T();
+
+        T val = _elements[_header->head];
+        _header->head = (_header->head + 1) % _header->capacity;
+        --_header->numElements;
+        onPopped(val);
+        pthread_cond_signal(&_header->notFullCondition);
+        return val;
+    }
+
+    void stop()
+    {
+        SharedMutexLock lock(&_header->lock);
+        _header->quit = 1;
+        pthread_cond_broadcast(&_header->notEmptyCondition);
+        pthread_cond_broadcast(&_header->notFullCondition);
+    }
+
+    const bool isStopped()
+    {
+        SharedMutexLock lock(&_header->lock);
+        return _header->quit != 0;
+    }
+
+    const uint32_t size()
+    {
+        SharedMutexLock lock(&_header->lock);
+        return _header->numElements;
+    }
+
+private:
+    struct Header
+    {
+        pthread_mutex_t lock;
+        pthread_cond_t notEmptyCondition;
+        pthread_cond_t notFullCondition;
+        uint32_t capacity;
+        uint32_t head;
+        uint32_t numElements;
+        uint32_t quit;
+    };
+
+    Header* _header;
+    T* _elements;
+};
@@ -0,0 +1,401 @@
+#include "StitchSession.hpp"
+#include "BufferPool.hpp"
+#include "PixelTraits.hpp"
+#ifdef USE_SHM
+#include "ShmBridge.hpp"
+#include "ShmChannel.hpp"
+#endif
+
+const size_t SESSION_BUFFER_POOL_SIZE = 64;
+
+struct StitchSession::ShmBridges
+{
+#ifdef USE_SHM
+    std::unique_ptr<ShmCoordinatorBridge> coordinatorBridge;
+    std::unique_ptr<ShmWorkerBridge> workerBridge;
+#endif
+};
+
+StitchSession::StitchSession(const StitchSessionOptions& options)
+    : _options(options)
+    , _started(false)
+    , _acceptsSubmits(false)
+    , _wakePending(false)
+    , _shmBridges(std::make_unique<ShmBridges>())
+    , _nextResultId(1)
+    , _nextPreviewId(1)
+    , _numSubmitted(0)
+    , _numDelivered(0)
+    , _bufferPool(new BufferPool(SESSION_BUFFER_POOL_SIZE))
+{
+    // The delivery thread sleeps until either queue has something for it
+    _resQueue.setNotifier([this] { wakeDelivery(); });
+    _previewQueue.setNotifier([this] { wakeDelivery(); });
+}
+
+StitchSession::~StitchSession()
+{
+    stop();
+    _bufferPool->release();
+}
+
+bool StitchSession::start()
+{
+    if (_started || !startWorkers(_jobQueue, _resQueue))
+        return false;
+
+    _deliveryThread = std::thread(&StitchSession::deliverResults, this);
+    std::lock_guard<std::mutex> lock(_deliveryLock);
+    _acceptsSubmits = true;
+    return true;
+}
+
+bool StitchSession::start(ShmChannel& channel, bool coordinator)
+{
+#ifdef USE_SHM
+    if (_started || !startWorkers(_shmJobQueue, _shmResQueue))
+        return false;
+
+    // Keep every stage busy and the registered queue full
+    unsigned int maxJobsInFlight = _options.numWorkers;
+    if (_options.registrationThreads > 0)
+        maxJobsInFlight += _options.registrationThreads + _options.pipelineDepth;
+    _shmBridges->workerBridge = std::make_unique<ShmWorkerBridge>(channel, _shmJobQueue, _shmResQueue, maxJobsInFlight);
+    _shmBridges->workerBridge->start();
+    if (coordinator)
+    {
+        _shmBridges->coordinatorBridge = std::make_unique<ShmCoordinatorBridge>(channel, _jobQueue, _resQueue);
+        _shmBridges->coordinatorBridge->start();
+    }
+
+    _deliveryThread = std::thread(&StitchSession::deliverResults, this);
+    std::lock_guard<std::mutex> lock(_deliveryLock);
+    _acceptsSubmits = coordinator;
+    return true;
+#else
+    std::cerr << "Error(StitchSession::start): Shared memory channels are not supported on this platform." << std::endl;
+    return false;
+#endif
+}
+
+void StitchSession::waitForChannel()
+{
+#ifdef USE_SHM
+    if (_shmBridges->workerBridge)
+        _shmBridges->workerBridge->wait();
+#endif
+}
+
+bool StitchSession::startWorkers(ThreadSafeDequeue<StitchJob>& workerJobQueue, ThreadSafeDequeue<ResIdPair>& workerResQueue)
+{
+    if (_options.numWorkers == 0 || _options.pipelineDepth == 0)
+    {
+        std::cerr << "Error(StitchSession::start): A session needs at least one worker and a pipeline depth of at least 1." << std::endl;
+        return false;
+    }
+
+    // The kept canvases are at the output scale, previews at another scale would replace them every time
+    bool previews = _options.previewScale > 0.0 && _options.tiledOutputDir.empty();
+    if (_options.incremental && previews)
+    {
+        std::cerr << "Error(StitchSession::start): Incremental compositing does not support previews." << std::endl;
+        return false;
+    }
+
+    // An incremental composite keeps pixels of earlier jobs, so it must not be found by content alone
+    if (_options.incremental && _options.resultCache)
+    {
+        std::cerr << "Error(StitchSession::start): Incremental compositing does not support a result cache." << std::endl;
+        return false;
+    }
+
+    // The cores are shared between the workers and the OpenCV and OpenMP threads each one starts
+    unsigned int numWorkers = _options.numWorkers + _options.registrationThreads;
+    _registeredQueue = std::make_unique<ThreadSafeDequeue<RegisteredJob>>(_options.pipelineDepth);
+    _threadBudget = std::make_shared<ThreadBudget>(std::thread::hardware_concurrency(), numWorkers, _options.intraOpThreads);
+    ThreadSafeDequeue<RegisteredJob>& registeredQueue = *_registeredQueue;
+    _threadBudget->setQueueDepth([&workerJobQueue, &registeredQueue] { return workerJobQueue.size() + registeredQueue.size(); });
+
+    // With registration threads, those register the jobs and the other workers only composite them
+    bool tiled = !_options.tiledOutputDir.empty();
+    std::shared_ptr<IncrementalCanvases> incrementalCanvases;
+    if (_options.incremental)
+        incrementalCanvases = std::make_shared<IncrementalCanvases>();
+    for (unsigned int i = 0; i < numWorkers; i++)
+    {
+        // Registration workers come first so they can be stopped before the compositing workers
+        StitcherWorker::PipelineStage stage = StitcherWorker::PipelineStage_All;
+        if (_options.registrationThreads > 0)
+            stage = i < _options.registrationThreads ? StitcherWorker::PipelineStage_Registration : StitcherWorker::PipelineStage_Compositing;
+
+        StitcherWorker stitcherWorker(workerJobQueue, workerResQueue, _options.stitcherMode);
+        stitcherWorker.setPipelineStage(stage, _registeredQueue.get());
+        stitcherWorker.setResultCache(_options.resultCache);
+        stitcherWorker.setThreadBudget(_threadBudget);
+        stitcherWorker.setCalibration(_options.calibration);
+        if (_options.calibrationExport)
+            stitcherWorker.setCalibrationExport(_options.calibrationExport, _options.calibrationExportPath, _options.exportWarpMaps);
+        stitcherWorker.setOutputScale(_options.outputScale);
+        stitcherWorker.setRegistrationScale(_options.registrationScale);
+        stitcherWorker.setIncrementalCompositing(incrementalCanvases);
+        stitcherWorker.setMetrics(_options.metrics, i);
+        if (tiled)
+            stitcherWorker.setTiledOutput(_options.tiledOutputDir, _options.tileCacheBytes, _options.previewScale);
+        if (previews)
+            stitcherWorker.setPreviewOutput(&_previewQueue, _options.previewScale);
+        std::thread workerThread(&StitcherWorker::run, stitcherWorker);
+        _workers.emplace_back(std::pair<std::thread, StitcherWorker>(std::move(workerThread), std::move(stitcherWorker)));
+    }
+
+    // The gauges sample the session, they are removed again when it stops
+    if (_options.metrics)
+    {
+        const std::string depthName = "parallelpanorama_queue_depth";
+        const std::string depthHelp = "Number of items waiting in each queue.";
+        addGauge(depthName, depthHelp, "queue=\"job\"", [this] { return _jobQueue.size(); });
+        addGauge(depthName, depthHelp, "queue=\"result\"", [this] { return _resQueue.size(); });
+        addGauge("parallelpanorama_intra_op_threads", "Threads OpenCV and OpenMP may use within each job.", "",
+                 [this] { return _threadBudget->getIntraOpThreads(); });
+        if (_options.registrationThreads > 0)
+            addGauge(depthName, depthHelp, "queue=\"registered\"", [this] { return _registeredQueue->size(); });
+        if (previews)
+            addGauge(depthName, depthHelp, "queue=\"preview\"", [this] { return _previewQueue.size(); });
+        if (&workerJobQueue == &_shmJobQueue)
+        {
+            addGauge(depthName, depthHelp, "queue=\"shm_job\"", [this] { return _shmJobQueue.size(); });
+            addGauge(depthName, depthHelp, "queue=\"shm_result\"", [this] { return _shmResQueue.size(); });
+        }
+    }
+
+    _started = true;
+    return true;
+}
+
+void StitchSession::stop()
+{
+    if (!_started.exchange(false))
+        return;
+
+    // A submit either got its job in before this or sees the session stopped, none is left waiting
+    {
+        std::lock_guard<std::mutex> lock(_deliveryLock);
+        _acceptsSubmits = false;
+    }
+
+    // No gauge samples the session past this point
+    for (auto& gauge : _gauges)
+        _options.metrics->removeGauge(gauge.first, gauge.second);
+    _gauges.clear();
+
+#ifdef USE_SHM
+    _shmBridges->coordinatorBridge.reset();
+    _shmBridges->workerBridge.reset();
+#endif
+
+    // Make sure the workers are done
+    _jobQueue.stop();
+    _shmJobQueue.stop();
+    for (unsigned int i = 0; i < _workers.size(); i++)
+    {
+        // The compositing workers wait on the registered queue until all registration workers are done
+        if (i == _options.registrationThreads)
+            _registeredQueue->stop();
+
+        _workers[i].second.quit();
+        _workers[i].first.join();
+    }
+    _workers.clear();
+
+    _resQueue.stop();
+    _previewQueue.stop();
+    if (_deliveryThread.joinable())
+        _deliveryThread.join();
+
+    // Nothing else will be delivered
+    std::lock_guard<std::mutex> lock(_deliveryLock);
+    for (auto& promise : _promises)
+        promise.second.set_value(cv::Mat());
+    _promises.clear();
+    _deliveredCondition.notify_all();
+}
+
+void StitchSession::addGauge(const std::string& name,
+                             const std::string& help,
+                             const std::string& labels,
+                             std::function<double()> sample)
+{
+    _options.metrics->setGauge(name, help, labels, sample);
+    _gauges.emplace_back(name, labels);
+}
+
+std::future<cv::Mat> StitchSession::submit(std::vector<cv::Mat> imgs, std::vector<cv::Mat> regImgs)
+{
+    std::promise<cv::Mat> promise;
+    std::future<cv::Mat> future = promise.get_future();
+    if (imgs.empty())
+    {
+        std::cerr << "Error(StitchSession::submit): No images were given." << std::endl;
+        promise.set_value(cv::Mat());
+        return future;
+    }
+
+    // Reduced registration images travel with the job, one per image
+    if (_options.registrationScale <= 1)
+    {
+        regImgs.clear();
+    }
+    else if (regImgs.empty())
+    {
+        double scale = 1.0 / _options.registrationScale;
+        for (const cv::Mat& img : imgs)
+        {
+            cv::Mat regImg;
+            cv::resize(img, regImg, cv::Size(), scale, scale, cv::INTER_AREA);
+            if (regImg.channels() > 1)
+                cv::cvtColor(regImg, regImg, regImg.channels() == 4 ? cv::COLOR_BGRA2GRAY : cv::COLOR_BGR2GRAY);
+            if (regImg.depth() != CV_8U)
+                regImg.convertTo(regImg, CV_8U, 1.0 / 257.0);
+            regImgs.push_back(regImg);
+        }
+    }
+    else if (regImgs.size() != imgs.size())
+    {
+        std::cerr << "Error(StitchSession::submit): Got " << regImgs.size() << " registration images for "
+                  << imgs.size() << " images." << std::endl;
+        promise.set_value(cv::Mat());
+        return future;
+    }
+
+    // Checked with the promise registered under the same lock, so stop cannot miss it
+    std::lock_guard<std::mutex> lock(_deliveryLock);
+    if (!_acceptsSubmits)
+    {
+        std::cerr << "Error(StitchSession::submit): Session does not accept submissions." << std::endl;
+        promise.set_value(cv::Mat());
+        return future;
+    }
+
+    unsigned int jobId = ++_numSubmitted;
+    _promises[jobId] = std::move(promise);
+    StitchJob job;
+    job.id = jobId;
+    job.imgs = std::move(imgs);
+    job.regImgs = std::move(regImgs);
+    _jobQueue.push(job);
+    return future;
+}
+
+std::future<cv::Mat> StitchSession::submit(const std::vector<ImageBuffer>& buffers)
+{
+    std::vector<cv::Mat> imgs;
+    for (const ImageBuffer& buffer : buffers)
+    {
+        size_t minStep = buffer.cols > 0 && isSupportedPixelType(buffer.type) ? buffer.cols * CV_ELEM_SIZE(buffer.type) : 0;
+        if (!buffer.data || buffer.rows <= 0 || minStep == 0 || (buffer.step != 0 && buffer.step < minStep))
+        {
+            std::cerr << "Error(StitchSession::submit): Image buffer " << imgs.size()
+                      << " has no data, an empty size, an unsupported type or too small a step." << std::endl;
+            std::promise<cv::Mat> promise;
+            promise.set_value(cv::Mat());
+            return promise.get_future();
+        }
+
+        cv::Mat callerImg(buffer.rows, buffer.cols, buffer.type, const_cast<void*>(buffer.data),
+                          buffer.step ? buffer.step : cv::Mat::AUTO_STEP);
+        cv::Mat img = _bufferPool->acquire(buffer.rows, buffer.cols, buffer.type);
+        callerImg.copyTo(img);
+        imgs.push_back(img);
+    }
+
+    return submit(std::move(imgs));
+}
+
+void StitchSession::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(_deliveryLock);
+    while (_started && _numDelivered.load() < _numSubmitted.load())
+        _deliveredCondition.wait(lock);
+}
+
+void StitchSession::wakeDelivery()
+{
+    {
+        std::lock_guard<std::mutex> lock(_wakeLock);
+        _wakePending = true;
+    }
+    _wakeCondition.notify_one();
+}
+
+void StitchSession::deliverResults()
+{
+    while (true)
+    {
+        // Previews are delivered while full images are still being stitched
+        ResIdPair preview;
+        while (_previewQueue.tryPop(preview))
+        {
+            // Previews of results that were already delivered are stale
+            if (preview.first >= _nextPreviewId)
+                _pendingPreviews[preview.first] = std::move(preview.second);
+        }
+        for (auto itr = _pendingPreviews.find(_nextPreviewId); itr != _pendingPreviews.end();
+             itr = _pendingPreviews.find(++_nextPreviewId))
+        {
+            if (_previewCallback && !itr->second.empty())
+                _previewCallback(itr->first, itr->second);
+            _pendingPreviews.erase(itr);
+        }
+
+        ResIdPair res;
+        if (_resQueue.tryPop(res))
+        {
+            deliver(res);
+            continue;
+        }
+        if (_resQueue.isStopped())
+            break;
+
+        // A push or stop after the queues were found empty leaves the wake up pending
+        std::unique_lock<std::mutex> lock(_wakeLock);
+        while (!_wakePending)
+            _wakeCondition.wait(lock);
+        _wakePending = false;
+    }
+
+    // Deliver what the workers finished before the session stopped
+    ResIdPair res;
+    while (_resQueue.tryPop(res))
+        deliver(res);
+}
+
+void StitchSession::deliver(ResIdPair& res)
+{
+    // Hold results back until every earlier one is out
+    _pendingResults[res.first] = std::move(res.second);
+    for (auto itr = _pendingResults.find(_nextResultId); itr != _pendingResults.end();
+         itr = _pendingResults.find(++_nextResultId))
+    {
+        if (_resultCallback)
+            _resultCallback(itr->first, itr->second);
+
+        {
+            std::lock_guard<std::mutex> lock(_deliveryLock);
+            auto promise = _promises.find(itr->first);
+            if (promise != _promises.end())
+            {
+                promise->second.set_value(std::move(itr->second));
+                _promises.erase(promise);
+            }
+            ++_numDelivered;
+            _deliveredCondition.notify_all();
+        }
+        _pendingResults.erase(itr);
+    }
+
+    // A preview arriving after its result is of no use
+    if (_nextPreviewId < _nextResultId)
+    {
+        _pendingPreviews.erase(_pendingPreviews.begin(), _pendingPreviews.lower_bound(_nextResultId));
+        _nextPreviewId = _nextResultId;
+    }
+}
@@ -0,0 +1,156 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "ImageStitcher.hpp"
+#include "Metrics.hpp"
+#include "ResultCache.hpp"
+#include "RigCalibration.hpp"
+#include "StitcherWorker.hpp"
+#include "ThreadBudget.hpp"
+#include "ThreadSafeDequeue.hpp"
+
+class BufferPool;
+class ShmChannel;
+
+struct StitchSessionOptions
+{
+    unsigned int numWorkers = 1; // Compositing workers when registration threads are used
+    unsigned int registrationThreads = 0;
+    unsigned int pipelineDepth = 4;
+    unsigned int intraOpThreads = 0; // 0 adapts to the queued frame groups
+    ImageStitcher::StitcherMode stitcherMode = ImageStitcher::StitcherMode_Manual;
+    float outputScale = 1.0;
+    float previewScale = 0.0; // Above 0, a preview at this scale is delivered before each result
+    int registrationScale = 1;
+    bool incremental = false; // Not with previews or a result cache
+    std::string tiledOutputDir; // Results are written as tiled TIFFs, previews at previewScale are delivered instead
+    size_t tileCacheBytes = 256 * 1024 * 1024;
+    std::shared_ptr<ResultCache> resultCache;
+    std::shared_ptr<RigCalibration> calibration;
+    std::shared_ptr<RigCalibration> calibrationExport;
+    std::string calibrationExportPath;
+    bool exportWarpMaps = false;
+    std::shared_ptr<MetricsRegistry> metrics;
+};
+
+// Pixels of one image owned by the caller, copied into the session's buffers on submit.
+// The type is one of the pixel types the stitcher supports.
+struct ImageBuffer
+{
+    const void* data = nullptr;
+    int rows = 0;
+    int cols = 0;
+    int type = CV_8UC3;
+    size_t step = 0; // 0 for rows without padding
+};
+
+// Long lived stitching service. The workers, their per pair registrations and the image
+// buffers stay warm from one frame group to the next, so an embedding service submits
+// frame groups for as long as it runs instead of starting a process per batch.
+// Results are delivered in submission order, through the futures returned by submit and
+// the result callback, both on the session's delivery thread. A frame group that failed
+// to stitch is delivered as an empty image.
+class StitchSession
+{
+public:
+    typedef std::function<void(unsigned int frameId, const cv::Mat& img)> ResultCallback;
+
+    StitchSession(const StitchSessionOptions& options);
+    ~StitchSession();
+
+    // Set before start
+    void setResultCallback(const ResultCallback& callback) { _resultCallback = callback; }
+    void setPreviewCallback(const ResultCallback& callback) { _previewCallback = callback; }
+
+    bool start();
+    // The workers take their jobs from the shared memory channel. A coordinator publishes its
+    // submissions to the channel, a worker process only serves it until waitForChannel returns
+    // and rejects submissions. A coordinator's results stay in the channel's result slots until
+    // released, so a caller keeping many of them should keep clones.
+    // Fails on platforms without shared memory support.
+    bool start(ShmChannel& channel, bool coordinator);
+    void waitForChannel();
+    void stop();
+
+    // Images are ordered left to right. With a registration scale above 1, reduced grayscale
+    // registration images are made from the images unless they are given.
+    std::future<cv::Mat> submit(std::vector<cv::Mat> imgs, std::vector<cv::Mat> regImgs = std::vector<cv::Mat>());
+    std::future<cv::Mat> submit(const std::vector<ImageBuffer>& buffers);
+
+    // Blocks until every submitted frame group was delivered
+    void waitIdle();
+
+    const unsigned int getNumSubmitted() { return _numSubmitted.load(); }
+    const unsigned int getNumDelivered() { return _numDelivered.load(); }
+
+private:
+    bool startWorkers(ThreadSafeDequeue<StitchJob>& workerJobQueue, ThreadSafeDequeue<ResIdPair>& workerResQueue);
+    void wakeDelivery();
+    void deliverResults();
+    void deliver(ResIdPair& res);
+    void addGauge(const std::string& name, const std::string& help, const std::string& labels, std::function<double()> sample);
+
+    StitchSessionOptions _options;
+    ResultCallback _resultCallback;
+    ResultCallback _previewCallback;
+    std::atomic_bool _started;
+    bool _acceptsSubmits; // Guarded by the delivery lock, not when only serving a shared memory channel
+
+    // Signalled by the result and preview queues, which are destroyed first
+    std::mutex _wakeLock;
+    std::condition_variable _wakeCondition;
+    bool _wakePending;
+
+    ThreadSafeDequeue<StitchJob> _jobQueue;
+    ThreadSafeDequeue<ResIdPair> _resQueue;
+    ThreadSafeDequeue<ResIdPair> _previewQueue;
+    ThreadSafeDequeue<StitchJob> _shmJobQueue;
+    ThreadSafeDequeue<ResIdPair> _shmResQueue;
+    std::unique_ptr<ThreadSafeDequeue<RegisteredJob>> _registeredQueue;
+    std::shared_ptr<ThreadBudget> _threadBudget;
+    std::vector<std::pair<std::thread, StitcherWorker>> _workers;
+    std::vector<std::pair<std::string, std::string>> _gauges; // Name and labels, removed on stop
+    struct ShmBridges; // Defined with the shared memory support, so the layout is the same without it
+    std::unique_ptr<ShmBridges> _shmBridges;
+
+    // Ordered delivery
+    std::thread _deliveryThread;
+    std::mutex _deliveryLock;
+    std::condition_variable _deliveredCondition;
+    std::map<unsigned int, std::promise<cv::Mat>> _promises;
+    std::map<unsigned int, cv::Mat> _pendingResults;
+    std::map<unsigned int, cv::Mat> _pendingPreviews;
+    unsigned int _nextResultId;
+    unsigned int _nextPreviewId;
+    std::atomic_uint _numSubmitted;
+    std::atomic_uint _numDelivered;
+
+    BufferPool* _bufferPool; // Released, not deleted, since submitted images may outlive the session
+};
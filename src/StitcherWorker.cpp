@@ -1,23 +1,212 @@
+#include <cfloat>
+#include <cmath>
+#include <filesystem>
+#include <sstream>
+
 #include "StitcherWorker.hpp"
+#include "TiledTiffWriter.hpp"
 
 const float STITCH_WIDTH_PERCENTAGE = 0.60;
 const float STITCH_HEIGHT_PERCENTAGE = 1.0;
+const int CANVAS_TILE_SIZE = 512;
+const double MAX_CHAIN_CANVAS_GROWTH = 2.0; // Canvas size over the summed image sizes before registration is deemed diverged
 
 void StitcherWorker::run()
 {
+    auto idleStart = std::chrono::steady_clock::now();
     while (!_quit)
     {
-        JobIdPair job(std::move(_jobQueue.pop()));
-        if (job.second.empty())
+        // Compositing stage workers take the jobs the registration stage is done with
+        RegisteredJob job;
+        if (_stage == PipelineStage_Compositing)
+        {
+            job = _registeredQueue->pop();
+        }
+        else
+        {
+            StitchJob stitchJob(std::move(_jobQueue.pop()));
+            job.id = stitchJob.id;
+            job.imgs = std::move(stitchJob.imgs);
+            job.regImgs = std::move(stitchJob.regImgs);
+        }
+
+        auto busyStart = std::chrono::steady_clock::now();
+        if (_idleTime)
+            _idleTime->addDuration(busyStart - idleStart);
+        if (job.imgs.empty())
+        {
+            if (_stage == PipelineStage_Compositing ? _registeredQueue->isStopped() : _jobQueue.isStopped())
+                break;
+            idleStart = busyStart;
             continue;
+        }
+        if (_threadBudget)
+            _threadBudget->beginJob();
+        processJob(job);
+        if (_threadBudget)
+            _threadBudget->endJob();
+
+        idleStart = std::chrono::steady_clock::now();
+        if (_busyTime)
+            _busyTime->addDuration(idleStart - busyStart);
+    }
+}
+
+void StitcherWorker::processJob(RegisteredJob& job)
+{
+    // Jobs from the registered queue already went through the registration stage
+    if (_stage != PipelineStage_Compositing)
+    {
+        if (!registerJob(job))
+            return;
+
+        if (_stage == PipelineStage_Registration)
+        {
+            _registeredQueue->push(job);
+            return;
+        }
+    }
+
+    compositeJob(job);
+}
 
+bool StitcherWorker::registerJob(RegisteredJob& job)
+{
+    // Reduced registration images come with the job, one per image
+    if (_registrationScale > 1)
+    {
+        if (job.regImgs.size() != job.imgs.size())
+        {
+            std::cerr << "Error(registerJob): Job " << job.id << " has " << job.regImgs.size()
+                      << " registration images for " << job.imgs.size() << " images." << std::endl;
+            failJob(job.id);
+            return false;
+        }
+
+        // Images added without a registration copy are registered at full resolution
+        for (const auto& regImg : job.regImgs)
+        {
+            if (regImg.empty())
+            {
+                job.regImgs.clear();
+                break;
+            }
+        }
+    }
+    else
+        job.regImgs.clear();
+
+    if (!_tiledOutputDir.empty())
+    {
+        if (registerChain(job))
+            return true;
+
+        failJob(job.id);
+        return false;
+    }
+
+    // Skip the work entirely if this image group was already stitched with the same settings
+    if (_resultCache)
+    {
         cv::Mat stitchedImg;
-        if (!stitchImgs(job.second, stitchedImg))
-            continue; // implement spdlog to do thread safe logging
+        job.cacheKey = _resultCache->computeKey(job.imgs, getCacheParams());
+        if (_resultCache->get(job.cacheKey, stitchedImg))
+        {
+            if (_previewQueue)
+            {
+                ResIdPair preview(job.id, cv::Mat());
+                cv::resize(stitchedImg, preview.second, cv::Size(), _previewScale / _outputScale,
+                           _previewScale / _outputScale, cv::INTER_AREA);
+                _previewQueue->push(preview);
+            }
 
-         ResIdPair pair(job.first, std::move(stitchedImg));
-        _resQueue.push(pair);
+            if (_cachedJobs)
+                _cachedJobs->add(1);
+            ResIdPair pair(job.id, std::move(stitchedImg));
+            _resQueue.push(pair);
+            return false;
+        }
     }
+
+    // Only the first level pairs can be registered ahead, the later levels register composited images.
+    // A pair that fails here is registered again by the compositing stage.
+    if (_stage == PipelineStage_Registration && _stitcherMode == ImageStitcher::StitcherMode_Manual)
+    {
+        _jobHomographies.clear();
+        _jobHomographyScales.clear();
+        for (size_t i = 0; i + 1 < job.imgs.size(); i += 2)
+        {
+            ImgPair regImgPair;
+            if (job.regImgs.size() == job.imgs.size())
+                regImgPair = ImgPair(job.regImgs[i], job.regImgs[i + 1]);
+            registerPair(i / 2, ImgPair(job.imgs[i], job.imgs[i + 1]), STITCH_WIDTH_PERCENTAGE,
+                         STITCH_HEIGHT_PERCENTAGE, 1.0, regImgPair.first.empty() ? nullptr : &regImgPair);
+        }
+        job.homographies = std::move(_jobHomographies);
+    }
+
+    return true;
+}
+
+void StitcherWorker::compositeJob(RegisteredJob& job)
+{
+    _jobRegImgs = std::move(job.regImgs);
+    if (!_tiledOutputDir.empty())
+    {
+        ResIdPair preview(job.id, cv::Mat());
+        if (!tiledStitchImgs(job.id, job.imgs, job.homographies, preview.second))
+        {
+            failJob(job.id);
+            return;
+        }
+
+        if (_stitchedJobs)
+            _stitchedJobs->add(1);
+        _resQueue.push(preview);
+        return;
+    }
+
+    // Registrations from the registration stage are at full resolution
+    _jobHomographies = std::move(job.homographies);
+    _jobHomographyScales.assign(_jobHomographies.size(), 1.0);
+    if (_previewQueue)
+    {
+        std::vector<cv::Mat> previewImgs(job.imgs);
+        // A failed preview is still pushed, empty, so previews stay in sequence
+        ResIdPair preview(job.id, cv::Mat());
+        stitchImgs(previewImgs, _previewScale, preview.second);
+        _previewQueue->push(preview);
+    }
+
+    cv::Mat stitchedImg;
+    if (!stitchImgs(job.imgs, _outputScale, stitchedImg))
+    {
+        failJob(job.id);
+        return; // implement spdlog to do thread safe logging
+    }
+
+    // The first successfully registered job provides the exported calibration
+    if (_calibrationExport && _stitcherMode == ImageStitcher::StitcherMode_Manual &&
+        _calibrationExport->claimExport())
+        exportCalibration();
+
+    if (_resultCache)
+        _resultCache->put(job.cacheKey, stitchedImg);
+
+    if (_stitchedJobs)
+        _stitchedJobs->add(1);
+    ResIdPair pair(job.id, std::move(stitchedImg));
+    _resQueue.push(pair);
+}
+
+void StitcherWorker::failJob(unsigned int jobId)
+{
+    if (_failedJobs)
+        _failedJobs->add(1);
+
+    // An empty result tells the consumer the job is done, so later results are not held back waiting for it
+    ResIdPair pair(jobId, cv::Mat());
+    _resQueue.push(pair);
 }
 
 void StitcherWorker::quit()
@@ -26,9 +215,171 @@ void StitcherWorker::quit()
     _quit = true;
 }
 
+const std::string StitcherWorker::getCacheParams()
+{
+    std::ostringstream params;
+    params << "mode=" << _stitcherMode
+           << ";width=" << STITCH_WIDTH_PERCENTAGE
+           << ";height=" << STITCH_HEIGHT_PERCENTAGE
+           << ";scale=" << _outputScale
+           << ";" << ImageStitcher::getParamsSignature();
+    if (_calibration)
+        params << ";calibration=" << _calibration->getSignature();
+    if (_registrationScale > 1)
+        params << ";registration=" << _registrationScale;
+    return params.str();
+}
+
+void StitcherWorker::setCalibration(std::shared_ptr<RigCalibration> calibration)
+{
+    _calibration = calibration;
+    _stitchers.clear();
+}
+
+void StitcherWorker::setIncrementalCompositing(std::shared_ptr<IncrementalCanvases> canvases)
+{
+    _incrementalCanvases = canvases;
+    for (unsigned int pairId = 0; pairId < _stitchers.size(); pairId++)
+        _stitchers[pairId].setIncremental(getIncrementalCanvas(pairId));
+}
+
+std::shared_ptr<IncrementalCanvas> StitcherWorker::getIncrementalCanvas(unsigned int pairId)
+{
+    return _incrementalCanvases ? _incrementalCanvases->get(pairId) : nullptr;
+}
+
+void StitcherWorker::setCalibrationExport(std::shared_ptr<RigCalibration> calibration,
+                                          const std::string& path,
+                                          bool includeWarpMaps)
+{
+    _calibrationExport = calibration;
+    _calibrationExportPath = path;
+    _exportWarpMaps = includeWarpMaps;
+}
+
+ImageStitcher& StitcherWorker::getStitcher(unsigned int pairId)
+{
+    while (_stitchers.size() <= pairId)
+    {
+        ImageStitcher stitcher;
+        stitcher.setIncremental(getIncrementalCanvas(_stitchers.size()));
+        PairCalibration pair;
+        if (_calibration && _calibration->getPair(_stitchers.size(), pair))
+        {
+            stitcher.setHomography(pair.homography);
+            stitcher.setCanvasBounds(pair.canvasBounds);
+            if (!pair.warpMap.empty())
+                stitcher.setWarpMap(pair.warpMap, cv::Size(pair.rightSize.width, pair.canvasBounds.height));
+        }
+        _stitchers.push_back(std::move(stitcher));
+    }
+
+    return _stitchers[pairId];
+}
+
+bool StitcherWorker::matchesCalibration(unsigned int pairId, const ImgPair& imgPair, float inputScale)
+{
+    PairCalibration pair;
+    if (!_calibration || !_calibration->getPair(pairId, pair))
+        return false;
+
+    // The images are at the input scale, the calibration at full resolution
+    auto matchesSize = [inputScale](const cv::Size& calibratedSize, const cv::Mat& img)
+    {
+        return std::abs(std::lround(img.cols / inputScale) - calibratedSize.width) <= 1 &&
+               std::abs(std::lround(img.rows / inputScale) - calibratedSize.height) <= 1;
+    };
+    return matchesSize(pair.leftSize, imgPair.first) && matchesSize(pair.rightSize, imgPair.second);
+}
+
+bool StitcherWorker::exportCalibration()
+{
+    for (unsigned int pairId = 0; pairId < _lastPairs.size(); pairId++)
+    {
+        PairCalibration pair = _lastPairs[pairId];
+        if (pair.homography.empty())
+            continue;
+
+        if (_exportWarpMaps)
+        {
+            cv::Size canvasSize(pair.leftSize.width + pair.rightSize.width, pair.canvasBounds.height);
+            ImageStitcher::buildWarpMap(pair.homography, canvasSize, pair.warpMap);
+        }
+        _calibrationExport->setPair(pairId, pair);
+    }
+
+    if (_calibrationExport->empty() || !_calibrationExport->save(_calibrationExportPath))
+    {
+        std::cerr << "Error(exportCalibration): Failed to export calibration to - " << _calibrationExportPath << std::endl;
+        return false;
+    }
+
+    std::cout << "Exported rig calibration to - " << _calibrationExportPath << std::endl;
+    return true;
+}
+
+void StitcherWorker::setTiledOutput(const std::string& outputDir, size_t tileCacheBytes, float previewScale)
+{
+    _tiledOutputDir = outputDir;
+    _tileCacheBytes = tileCacheBytes;
+    _previewScale = previewScale;
+}
+
+void StitcherWorker::setPipelineStage(PipelineStage stage, ThreadSafeDequeue<RegisteredJob>* registeredQueue)
+{
+    _stage = stage;
+    _registeredQueue = registeredQueue;
+}
+
+void StitcherWorker::setMetrics(std::shared_ptr<MetricsRegistry> metrics, unsigned int workerId)
+{
+    _metrics = metrics;
+    if (!_metrics)
+        return;
+
+    const char* stageNames[] = { "all", "registration", "compositing" };
+    std::string workerLabel = "worker=\"" + std::to_string(workerId) + "\",pipeline_stage=\"" + stageNames[_stage] + "\"";
+    _busyTime = &_metrics->getCounter("parallelpanorama_worker_busy_seconds_total",
+                                      "Time the stitcher worker spent on jobs.", workerLabel, 1e-6);
+    _idleTime = &_metrics->getCounter("parallelpanorama_worker_idle_seconds_total",
+                                      "Time the stitcher worker spent waiting for jobs.", workerLabel, 1e-6);
+
+    const std::string stageName = "parallelpanorama_stage_seconds";
+    const std::string stageHelp = "Time taken by each stitch stage, per image pair.";
+    _registrationTime = &_metrics->getHistogram(stageName, stageHelp, "stage=\"registration\"");
+    _compositingTime = &_metrics->getHistogram(stageName, stageHelp, "stage=\"compositing\"");
+    _cvStitchTime = &_metrics->getHistogram(stageName, stageHelp, "stage=\"opencv_stitch\"");
+
+    const std::string jobsName = "parallelpanorama_jobs_total";
+    const std::string jobsHelp = "Image groups handled by the stitcher workers, by outcome.";
+    _stitchedJobs = &_metrics->getCounter(jobsName, jobsHelp, "result=\"stitched\"");
+    _cachedJobs = &_metrics->getCounter(jobsName, jobsHelp, "result=\"cached\"");
+    _failedJobs = &_metrics->getCounter(jobsName, jobsHelp, "result=\"failed\"");
+}
+
+void StitcherWorker::setPreviewOutput(ThreadSafeDequeue<ResIdPair>* previewQueue, float previewScale)
+{
+    _previewQueue = previewQueue;
+    _previewScale = previewScale;
+}
+
 bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitchedImg)
 {
-    static int imgNum = 0;
+    return stitchImgs(curImages, _outputScale, stitchedImg);
+}
+
+bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, float outputScale, cv::Mat& stitchedImg)
+{
+    return stitchImgs(curImages, 0, 1.0, outputScale, stitchedImg);
+}
+
+bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages,
+                                unsigned int pairIdOffset,
+                                float inputScale,
+                                float outputScale,
+                                cv::Mat& stitchedImg)
+{
+    float resizeScale = outputScale / inputScale;
     std::vector<cv::Mat> nextImages;
     for (int i = 0; i < curImages.size(); i += 2)
     {
@@ -36,13 +387,23 @@ bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitch
         if (_stitcherMode == ImageStitcher::StitcherMode_OpenCV)
         {
             std::vector<cv::Mat> imgs = { curImages[i], curImages[i + 1], };
+            if (resizeScale != 1.0)
+            {
+                for (cv::Mat& img : imgs)
+                    cv::resize(img, img, cv::Size(), resizeScale, resizeScale, cv::INTER_AREA);
+            }
+
             if (_cvStitcher.empty())
             {
                 std::cerr << "Error(stitchAllImgs): OpenCV Stitcher is null." << std::endl;
                 return false;
             }
 
-            cv::Stitcher::Status res = _cvStitcher->stitch(imgs, curStitchedImg);
+            cv::Stitcher::Status res;
+            {
+                ScopedLatency stitchTime(_cvStitchTime);
+                res = _cvStitcher->stitch(imgs, curStitchedImg);
+            }
             if (res != cv::Stitcher::OK)
             {
                 std::cerr << "Error(stitchAllImgs): Failed to stitch images with opencv for index i - "
@@ -54,7 +415,15 @@ bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitch
         {
             //std::cout << "BDUB(stitchImgs): Manually stitching images." << std::endl;
             ImgPair imgPair(curImages[i], curImages[i + 1]);
-            if (!manualStitchImgs(imgPair, STITCH_WIDTH_PERCENTAGE, STITCH_HEIGHT_PERCENTAGE, curStitchedImg))
+            unsigned int pairId = pairIdOffset + i / 2;
+
+            // Only the first level pairs are cameras with registration images
+            ImgPair regImgPair;
+            if (pairIdOffset == 0 && _jobRegImgs.size() == curImages.size())
+                regImgPair = ImgPair(_jobRegImgs[i], _jobRegImgs[i + 1]);
+            if (!manualStitchImgs(pairId, imgPair, STITCH_WIDTH_PERCENTAGE, STITCH_HEIGHT_PERCENTAGE,
+                                  inputScale, outputScale, curStitchedImg,
+                                  regImgPair.first.empty() ? nullptr : &regImgPair))
             {
                 std::cerr << "Error(stitchAllImgs): Failed to manually stitch images for index i - " << i << std::endl;
                 continue;
@@ -64,6 +433,7 @@ bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitch
 
         nextImages.push_back(std::move(curStitchedImg));
     }
+    pairIdOffset += curImages.size() / 2;
     curImages.clear();
 
     // Check if we're done
@@ -77,43 +447,243 @@ bool StitcherWorker::stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitch
         return true;
     }
 
-    if (!stitchImgs(nextImages, stitchedImg))
+    if (!stitchImgs(nextImages, pairIdOffset, outputScale, outputScale, stitchedImg))
         return false;
 
     return true;
 }
 
-bool StitcherWorker::manualStitchImgs(const ImgPair& imgPair,
-                                      float roiWidthPerc,
-                                      float roiHeightPerc,
-                                      cv::Mat& stitchedImg)
+bool StitcherWorker::registerChain(RegisteredJob& job)
 {
-    cv::Mat homography;
-    if (roiWidthPerc <= 0.0 || roiHeightPerc <= 0.0)
+    const std::vector<cv::Mat>& curImages = job.imgs;
+    if (curImages.empty() || !TiledTiffWriter::isSupportedType(curImages.front().type()))
+    {
+        std::cerr << "Error(registerChain): No images or unsupported image type for job - " << job.id << std::endl;
+        return false;
+    }
+
+    // Register every camera to its left neighbour and chain the registrations into the first camera's frame
+    if (_chainStitchers.size() < curImages.size())
+        _chainStitchers.resize(curImages.size());
+    std::vector<cv::Mat>& chainHomogs = job.homographies;
+    chainHomogs = { cv::Mat::eye(3, 3, CV_64F) };
+    for (size_t i = 0; i + 1 < curImages.size(); i++)
     {
-        if (!_stitcher.computeHomography(imgPair, homography))
+        bool useRegImgs = job.regImgs.size() == curImages.size();
+        ImgPair regPair = useRegImgs ? ImgPair(job.regImgs[i], job.regImgs[i + 1]) : ImgPair(curImages[i], curImages[i + 1]);
+        cv::Mat homography;
         {
-            std::cerr << "Error(manualStitchImgs): Failed to compute homography for images." << std::endl;
-            return false;
+            ScopedLatency registrationTime(_registrationTime);
+            if (!_chainStitchers[i].computeHomography(regPair, STITCH_WIDTH_PERCENTAGE, STITCH_HEIGHT_PERCENTAGE, homography))
+            {
+                std::cerr << "Error(registerChain): Failed to register images " << i << " and " << i + 1 << std::endl;
+                return false;
+            }
         }
+
+        homography = ImageStitcher::scaleHomography(homography, static_cast<double>(curImages[i].cols) / regPair.first.cols);
+        chainHomogs.push_back(chainHomogs.back() * homography);
     }
-    else
+
+    return true;
+}
+
+bool StitcherWorker::tiledStitchImgs(unsigned int jobId,
+                                     const std::vector<cv::Mat>& curImages,
+                                     const std::vector<cv::Mat>& chainHomogs,
+                                     cv::Mat& preview)
+{
+    if (chainHomogs.size() != curImages.size())
+    {
+        std::cerr << "Error(tiledStitchImgs): Job " << jobId << " was not registered." << std::endl;
+        return false;
+    }
+
+    // The canvas spans every warped camera
+    double minX(DBL_MAX), minY(DBL_MAX), maxX(-DBL_MAX), maxY(-DBL_MAX);
+    double sumWidth(0.0), sumHeight(0.0);
+    for (size_t i = 0; i < curImages.size(); i++)
+    {
+        std::vector<cv::Point2f> corners = { cv::Point2f(0, 0), cv::Point2f(curImages[i].cols, 0),
+                                             cv::Point2f(0, curImages[i].rows),
+                                             cv::Point2f(curImages[i].cols, curImages[i].rows) };
+        cv::perspectiveTransform(corners, corners, chainHomogs[i]);
+        for (const cv::Point2f& corner : corners)
+        {
+            minX = std::min(minX, static_cast<double>(corner.x));
+            minY = std::min(minY, static_cast<double>(corner.y));
+            maxX = std::max(maxX, static_cast<double>(corner.x));
+            maxY = std::max(maxY, static_cast<double>(corner.y));
+        }
+        sumWidth += curImages[i].cols;
+        sumHeight = std::max(sumHeight, static_cast<double>(curImages[i].rows));
+    }
+    if (maxX - minX > sumWidth * MAX_CHAIN_CANVAS_GROWTH || maxY - minY > sumHeight * MAX_CHAIN_CANVAS_GROWTH)
+    {
+        std::cerr << "Error(tiledStitchImgs): Registration chain diverged for job - " << jobId << std::endl;
+        return false;
+    }
+
+    cv::Matx33d canvasOffset(1, 0, -std::floor(minX), 0, 1, -std::floor(minY), 0, 0, 1);
+    std::vector<cv::Mat> canvasHomogs;
+    for (const cv::Mat& chainHomog : chainHomogs)
+        canvasHomogs.push_back(cv::Mat(canvasOffset) * chainHomog);
+    cv::Size canvasSize(static_cast<int>(std::ceil((maxX - std::floor(minX)) * _outputScale)),
+                        static_cast<int>(std::ceil((maxY - std::floor(minY)) * _outputScale)));
+
+    // Tiles go straight from the canvas to the TIFF, and into the preview
+    std::filesystem::path outputDir(_tiledOutputDir);
+    std::filesystem::path tiffPath = outputDir / (std::to_string(jobId) + ".tif");
+    int type = curImages.front().type();
+    TiledCanvas canvas(canvasSize, type, CANVAS_TILE_SIZE, _tileCacheBytes,
+                       (outputDir / ("." + std::to_string(jobId) + ".tiles")).string());
+    TiledTiffWriter writer;
+    if (!writer.open(tiffPath.string(), canvasSize, type, CANVAS_TILE_SIZE))
+        return false;
+
+    float previewRatio = _previewScale / _outputScale;
+    preview = cv::Mat::zeros(std::max(1, static_cast<int>(canvasSize.height * previewRatio)),
+                             std::max(1, static_cast<int>(canvasSize.width * previewRatio)), type);
+    auto sink = [&](int tileX, int tileY, const cv::Mat& tile) -> bool
     {
-        if (!_stitcher.computeHomography(imgPair, roiWidthPerc, roiHeightPerc, homography))
+        cv::Rect tileRect = canvas.getTileRect(tileX, tileY);
+        cv::Rect previewRect(static_cast<int>(tileRect.x * previewRatio), static_cast<int>(tileRect.y * previewRatio), 0, 0);
+        previewRect.width = std::min(static_cast<int>((tileRect.x + tileRect.width) * previewRatio), preview.cols) - previewRect.x;
+        previewRect.height = std::min(static_cast<int>((tileRect.y + tileRect.height) * previewRatio), preview.rows) - previewRect.y;
+        if (previewRect.width > 0 && previewRect.height > 0)
         {
-            std::cerr << "Error(manualStitchImgs): Failed to compute homography-roi for images." << std::endl;
+            cv::Mat previewTile = preview(previewRect);
+            cv::resize(tile(cv::Rect(0, 0, tileRect.width, tileRect.height)), previewTile, previewRect.size(), 0, 0, cv::INTER_AREA);
+        }
+
+        return writer.writeTile(tileX, tileY, tile);
+    };
+
+    {
+        ScopedLatency compositingTime(_compositingTime);
+        if (!ImageStitcher::compositeTiled(curImages, canvasHomogs, _outputScale, canvas, sink))
+        {
+            std::cerr << "Error(tiledStitchImgs): Failed to composite job - " << jobId << std::endl;
+            writer.abort();
             return false;
         }
     }
 
-    std::vector<ImgPair> imgPairs = { imgPair };
+    return writer.close();
+}
+
+bool StitcherWorker::registerPair(unsigned int pairId,
+                                  const ImgPair& imgPair,
+                                  float roiWidthPerc,
+                                  float roiHeightPerc,
+                                  float inputScale,
+                                  const ImgPair* regImgPair)
+{
+    ImageStitcher& stitcher = getStitcher(pairId);
+    if (_jobHomographies.size() <= pairId)
+    {
+        _jobHomographies.resize(pairId + 1);
+        _jobHomographyScales.resize(pairId + 1, 0.0);
+    }
+
+    // Registration is kept in full resolution coordinates so the preview and full passes
+    // of a job can share it, unless it was computed from lower resolution images
+    cv::Mat& fullHomography = _jobHomographies[pairId];
+    if (fullHomography.empty() || _jobHomographyScales[pairId] < inputScale)
+    {
+        // Calibrated pairs skip registration entirely, unless the calibration was made for other image sizes
+        cv::Mat homography;
+        if (stitcher.getHomography(homography) && !matchesCalibration(pairId, imgPair, inputScale))
+        {
+            std::cerr << "Error(registerPair): Calibration of pair " << pairId
+                      << " was made for other image sizes, registering the pair instead." << std::endl;
+            stitcher = ImageStitcher();
+            stitcher.setIncremental(getIncrementalCanvas(pairId));
+            homography = cv::Mat();
+        }
+
+        if (!homography.empty())
+        {
+            fullHomography = homography;
+            _jobHomographyScales[pairId] = 1.0;
+        }
+        else
+        {
+            ScopedLatency registrationTime(_registrationTime);
+            const ImgPair& registrationPair = regImgPair ? *regImgPair : imgPair;
+            if (roiWidthPerc <= 0.0 || roiHeightPerc <= 0.0)
+            {
+                if (!stitcher.computeHomography(registrationPair, homography))
+                {
+                    std::cerr << "Error(registerPair): Failed to compute homography for images." << std::endl;
+                    return false;
+                }
+            }
+            else
+            {
+                if (!stitcher.computeHomography(registrationPair, roiWidthPerc, roiHeightPerc, homography))
+                {
+                    std::cerr << "Error(registerPair): Failed to compute homography-roi for images." << std::endl;
+                    return false;
+                }
+            }
+
+            // Registration images are reduced by design, so their registration serves every pass of the job
+            float registrationScale = inputScale;
+            if (regImgPair)
+                registrationScale *= static_cast<float>(regImgPair->first.cols) / imgPair.first.cols;
+            fullHomography = ImageStitcher::scaleHomography(homography, 1.0 / registrationScale);
+            _jobHomographyScales[pairId] = regImgPair ? 1.0 : inputScale;
+        }
+    }
+
+    return true;
+}
+
+bool StitcherWorker::manualStitchImgs(unsigned int pairId,
+                                      const ImgPair& imgPair,
+                                      float roiWidthPerc,
+                                      float roiHeightPerc,
+                                      float inputScale,
+                                      float outputScale,
+                                      cv::Mat& stitchedImg,
+                                      const ImgPair* regImgPair)
+{
+    ImageStitcher& stitcher = getStitcher(pairId);
+    if (!registerPair(pairId, imgPair, roiWidthPerc, roiHeightPerc, inputScale, regImgPair))
+        return false;
+
+    // Composite directly at the output scale
+    ScopedLatency compositingTime(_compositingTime);
+    ImgPair scaledPair = imgPair;
+    float resizeScale = outputScale / inputScale;
+    if (resizeScale != 1.0)
+    {
+        cv::resize(imgPair.first, scaledPair.first, cv::Size(), resizeScale, resizeScale, cv::INTER_AREA);
+        cv::resize(imgPair.second, scaledPair.second, cv::Size(), resizeScale, resizeScale, cv::INTER_AREA);
+    }
+    cv::Mat homography = ImageStitcher::scaleHomography(_jobHomographies[pairId], outputScale);
+
+    std::vector<ImgPair> imgPairs = { scaledPair };
     std::vector<cv::Mat> curStitchedImgs;
-    if (!_stitcher.manualStitch(homography, imgPairs, curStitchedImgs))
+    if (!stitcher.manualStitch(homography, imgPairs, curStitchedImgs))
     {
         std::cerr << "Error(manualStitchImgs): Failed to stitch images." << std::endl;
         return false;
     }
 
+    // Remember full resolution registrations so they can be exported as a calibration
+    if (outputScale == 1.0)
+    {
+        if (_lastPairs.size() <= pairId)
+            _lastPairs.resize(pairId + 1);
+        PairCalibration& pair = _lastPairs[pairId];
+        pair.homography = homography;
+        pair.leftSize = imgPair.first.size();
+        pair.rightSize = imgPair.second.size();
+        pair.canvasBounds = stitcher.getCanvasBounds();
+    }
+
     stitchedImg = std::move(curStitchedImgs.front());
     if (stitchedImg.empty())
         return false;
@@ -21,20 +21,61 @@ Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
 
 #include "ThreadSafeDequeue.hpp"
 #include "ImageStitcher.hpp"
+#include "Metrics.hpp"
+#include "ResultCache.hpp"
+#include "RigCalibration.hpp"
+#include "ThreadBudget.hpp"
 
 typedef std::pair<cv::Mat, cv::Mat> ImgPair;
-typedef std::pair<unsigned int, std::vector<cv::Mat>> JobIdPair;
 typedef std::pair<unsigned int, cv::Mat> ResIdPair;
 
+// Images of one stitch job, ordered left to right
+struct StitchJob
+{
+    unsigned int id = 0;
+    std::vector<cv::Mat> imgs;
+    std::vector<cv::Mat> regImgs; // Reduced registration images, one per image when registering on reduced images
+};
+
+// A job between the registration and compositing stages of a pipelined stitch
+struct RegisteredJob : StitchJob
+{
+    std::vector<cv::Mat> homographies; // Full resolution, per first level pair or per camera chain link
+    uint64_t cacheKey = 0;
+};
+
 class StitcherWorker 
 {
 public:
-    StitcherWorker(ThreadSafeDequeue<JobIdPair>& jobQueue,
+    enum PipelineStage
+    {
+        PipelineStage_All = 0,
+        PipelineStage_Registration = 1,
+        PipelineStage_Compositing = 2
+    };
+
+    StitcherWorker(ThreadSafeDequeue<StitchJob>& jobQueue,
                    ThreadSafeDequeue<ResIdPair>& resQueue,
                    ImageStitcher::StitcherMode stitcherMode)
         : _jobQueue(jobQueue)
         , _resQueue(resQueue)
         , _stitcherMode(stitcherMode)
+        , _stage(PipelineStage_All)
+        , _registeredQueue(nullptr)
+        , _exportWarpMaps(false)
+        , _outputScale(1.0)
+        , _previewQueue(nullptr)
+        , _previewScale(1.0)
+        , _tileCacheBytes(0)
+        , _registrationScale(1)
+        , _busyTime(nullptr)
+        , _idleTime(nullptr)
+        , _registrationTime(nullptr)
+        , _compositingTime(nullptr)
+        , _cvStitchTime(nullptr)
+        , _stitchedJobs(nullptr)
+        , _cachedJobs(nullptr)
+        , _failedJobs(nullptr)
         , _quit(false)
     {
         if (_stitcherMode == ImageStitcher::StitcherMode::StitcherMode_OpenCV)
@@ -51,18 +92,118 @@ public:
     void run();
     void quit();
 
+    void setResultCache(std::shared_ptr<ResultCache> resultCache) { _resultCache = resultCache; }
+
+    // Every job is stitched within the intra-op thread limit of the shared budget
+    void setThreadBudget(std::shared_ptr<ThreadBudget> threadBudget) { _threadBudget = threadBudget; }
+    const std::string getCacheParams();
+
+    // A loaded calibration replaces registration for every stitch pair it contains
+    void setCalibration(std::shared_ptr<RigCalibration> calibration);
+    void setCalibrationExport(std::shared_ptr<RigCalibration> calibration,
+                              const std::string& path,
+                              bool includeWarpMaps);
+
+    // Scale of the stitched images relative to the input images. Compositing is done
+    // directly at this scale rather than resizing a full resolution result.
+    void setOutputScale(float scale) { _outputScale = scale; }
+
+    // Progressive output: a preview at previewScale is pushed to the preview queue before
+    // the image is stitched at the output scale. Registration is shared by both.
+    void setPreviewOutput(ThreadSafeDequeue<ResIdPair>* previewQueue, float previewScale);
+
+    // Out-of-core output for panoramas too large for memory: the cameras are registered as a chain
+    // and composited tile by tile into <outputDir>/<id>.tif. The result queue gets a preview at
+    // previewScale instead of the full image.
+    void setTiledOutput(const std::string& outputDir, size_t tileCacheBytes, float previewScale);
+
+    // With a registration scale above 1, every job carries a reduced grayscale copy of each image
+    // after the full resolution images, and the cameras are registered on those copies
+    void setRegistrationScale(int scale) { _registrationScale = scale; }
+
+    // Incremental compositing: each stitch pair keeps its last canvas and only composites again
+    // where the images changed since the previous job. The canvases are shared by all workers.
+    void setIncrementalCompositing(std::shared_ptr<IncrementalCanvases> canvases);
+
+    // Pipelined stitching: registration stage workers take jobs from the job queue, register their
+    // first level pairs (or camera chain) and push them to the bounded registered queue, where the
+    // compositing stage workers finish them. Each stage has its own pool of workers.
+    void setPipelineStage(PipelineStage stage, ThreadSafeDequeue<RegisteredJob>* registeredQueue);
+
+    // Busy and idle time are reported under the given worker id and the pipeline stage set before
+    void setMetrics(std::shared_ptr<MetricsRegistry> metrics, unsigned int workerId);
+
     bool stitchImgs(std::vector<cv::Mat>& curImages, cv::Mat& stitchedImg);
+    bool stitchImgs(std::vector<cv::Mat>& curImages, float outputScale, cv::Mat& stitchedImg);
 
-    bool manualStitchImgs(const ImgPair& imgPairs,
+    bool manualStitchImgs(unsigned int pairId,
+                          const ImgPair& imgPairs,
                           float roiWidthPerc,
                           float roiHeightPerc,
-                          cv::Mat& stitchedImg);
+                          float inputScale,
+                          float outputScale,
+                          cv::Mat& stitchedImg,
+                          const ImgPair* regImgPair = nullptr);
 
 private:
-    ThreadSafeDequeue<JobIdPair>& _jobQueue;
+    void processJob(RegisteredJob& job);
+    bool registerJob(RegisteredJob& job);
+    void compositeJob(RegisteredJob& job);
+    bool registerPair(unsigned int pairId,
+                      const ImgPair& imgPair,
+                      float roiWidthPerc,
+                      float roiHeightPerc,
+                      float inputScale,
+                      const ImgPair* regImgPair);
+    bool registerChain(RegisteredJob& job);
+    bool stitchImgs(std::vector<cv::Mat>& curImages,
+                    unsigned int pairIdOffset,
+                    float inputScale,
+                    float outputScale,
+                    cv::Mat& stitchedImg);
+    bool tiledStitchImgs(unsigned int jobId,
+                         const std::vector<cv::Mat>& curImages,
+                         const std::vector<cv::Mat>& chainHomogs,
+                         cv::Mat& preview);
+    ImageStitcher& getStitcher(unsigned int pairId);
+    std::shared_ptr<IncrementalCanvas> getIncrementalCanvas(unsigned int pairId);
+    bool matchesCalibration(unsigned int pairId, const ImgPair& imgPair, float inputScale);
+    void failJob(unsigned int jobId);
+    bool exportCalibration();
+
+    ThreadSafeDequeue<StitchJob>& _jobQueue;
     ThreadSafeDequeue<ResIdPair>& _resQueue;
     ImageStitcher::StitcherMode _stitcherMode;
-    ImageStitcher _stitcher;
+    PipelineStage _stage;
+    ThreadSafeDequeue<RegisteredJob>* _registeredQueue;
+    std::vector<ImageStitcher> _stitchers; // One per stitch pair so each keeps its own registration
+    std::vector<ImageStitcher> _chainStitchers; // One per pair of neighbouring cameras for tiled output
     cv::Ptr<cv::Stitcher> _cvStitcher;
+    std::shared_ptr<ResultCache> _resultCache;
+    std::shared_ptr<ThreadBudget> _threadBudget;
+    std::shared_ptr<RigCalibration> _calibration;
+    std::shared_ptr<RigCalibration> _calibrationExport;
+    std::string _calibrationExportPath;
+    bool _exportWarpMaps;
+    std::vector<PairCalibration> _lastPairs;
+    float _outputScale;
+    ThreadSafeDequeue<ResIdPair>* _previewQueue;
+    float _previewScale;
+    std::string _tiledOutputDir;
+    size_t _tileCacheBytes;
+    int _registrationScale;
+    std::shared_ptr<IncrementalCanvases> _incrementalCanvases;
+    std::vector<cv::Mat> _jobRegImgs; // Reduced registration images of the current job
+    std::vector<cv::Mat> _jobHomographies; // Full resolution registration of the current job
+    std::vector<float> _jobHomographyScales; // Image scale each registration was computed at
+    std::shared_ptr<MetricsRegistry> _metrics;
+    MetricCounter* _busyTime;
+    MetricCounter* _idleTime;
+    LatencyHistogram* _registrationTime;
+    LatencyHistogram* _compositingTime;
+    LatencyHistogram* _cvStitchTime;
+    MetricCounter* _stitchedJobs;
+    MetricCounter* _cachedJobs;
+    MetricCounter* _failedJobs;
     volatile bool _quit;
 };
\ No newline at end of file
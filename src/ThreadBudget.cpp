@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <opencv2/opencv.hpp>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "ThreadBudget.hpp"
+
+// OpenCV reconfigures its thread pool on every change, so the split is not changed more often than this
+const std::chrono::milliseconds THREAD_BUDGET_REBALANCE_INTERVAL(500);
+
+ThreadBudget::ThreadBudget(unsigned int numCores, unsigned int numWorkers, unsigned int intraOpThreads)
+    : _numCores(std::max(1u, numCores))
+    , _numWorkers(std::max(1u, numWorkers))
+    , _adaptive(intraOpThreads == 0)
+    , _busyWorkers(0)
+    , _intraOpThreads(0)
+{
+#ifdef _OPENMP
+    // Parallel regions inside parallel regions would multiply the budget
+    omp_set_max_active_levels(1);
+#endif
+
+    // Until jobs arrive assume every worker is busy
+    applyIntraOpThreads(_adaptive ? std::max(1, _numCores / _numWorkers) : static_cast<int>(intraOpThreads));
+    _lastRebalance = std::chrono::steady_clock::now();
+}
+
+void ThreadBudget::beginJob()
+{
+    _busyWorkers.fetch_add(1, std::memory_order_relaxed);
+    rebalance();
+
+#ifdef _OPENMP
+    // The OpenMP thread count is per thread, so each worker picks it up when it starts a job
+    omp_set_num_threads(getIntraOpThreads());
+#endif
+}
+
+void ThreadBudget::endJob()
+{
+    _busyWorkers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void ThreadBudget::rebalance()
+{
+    if (!_adaptive)
+        return;
+
+    std::unique_lock<std::mutex> lock(_rebalanceLock, std::try_to_lock);
+    auto now = std::chrono::steady_clock::now();
+    if (!lock.owns_lock() || now - _lastRebalance < THREAD_BUDGET_REBALANCE_INTERVAL)
+        return;
+    _lastRebalance = now;
+
+    // Every queued job will soon keep another worker busy
+    int queued = _queueDepth ? std::max(0, _queueDepth()) : 0;
+    int activeWorkers = std::clamp(_busyWorkers.load(std::memory_order_relaxed) + queued, 1, _numWorkers);
+    applyIntraOpThreads(std::max(1, _numCores / activeWorkers));
+}
+
+void ThreadBudget::applyIntraOpThreads(int intraOpThreads)
+{
+    if (intraOpThreads == _intraOpThreads.load(std::memory_order_relaxed))
+        return;
+
+    _intraOpThreads.store(intraOpThreads, std::memory_order_relaxed);
+    cv::setNumThreads(intraOpThreads);
+}
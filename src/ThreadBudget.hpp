@@ -0,0 +1,59 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+
+// Splits the cores between frame level workers and the intra-op parallelism of OpenCV and
+// OpenMP, so N workers that each fan out to every core do not oversubscribe the machine.
+// Shared by all stitcher workers. With an adaptive budget the split follows the number of
+// busy workers and queued jobs: a deep queue keeps every worker busy with single threaded
+// ops, a shallow one gives the few busy workers the rest of the cores.
+class ThreadBudget
+{
+public:
+    // An intraOpThreads of 0 makes the budget adaptive, otherwise it stays fixed
+    ThreadBudget(unsigned int numCores, unsigned int numWorkers, unsigned int intraOpThreads = 0);
+    ~ThreadBudget() {};
+
+    // Samples the number of jobs waiting for a worker
+    void setQueueDepth(const std::function<int()>& queueDepth) { _queueDepth = queueDepth; }
+
+    // Called by a worker thread around each job, applies the current OpenMP limit to the calling thread
+    void beginJob();
+    void endJob();
+
+    const int getIntraOpThreads() { return _intraOpThreads.load(std::memory_order_relaxed); }
+    const int getNumCores() { return _numCores; }
+
+private:
+    void rebalance();
+    void applyIntraOpThreads(int intraOpThreads);
+
+    const int _numCores;
+    const int _numWorkers;
+    const bool _adaptive;
+    std::function<int()> _queueDepth;
+    std::atomic_int _busyWorkers;
+    std::atomic_int _intraOpThreads;
+
+    std::mutex _rebalanceLock;
+    std::chrono::steady_clock::time_point _lastRebalance;
+};
@@ -20,13 +20,16 @@ Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <functional>
 
 template <class T> class ThreadSafeDequeue
 {
 public:
-    ThreadSafeDequeue()
-        : _numElements(0)
+    // A capacity of 0 leaves the queue unbounded, otherwise push blocks while the queue is full
+    ThreadSafeDequeue(int capacity = 0)
+        : _capacity(capacity)
         , _quit(false)
+        , _numElements(0)
     {}
 
     ~ThreadSafeDequeue()
@@ -36,51 +39,87 @@ public:
 
     void push(T& t)
     {
-        bool mustWakeDequeuers(false);
-        std::lock_guard<std::mutex> lock(_enqueueLock);
+        std::unique_lock<std::mutex> lock(_lock);
+        while (_capacity > 0 && static_cast<int>(_queue.size()) >= _capacity && !_quit.load(std::memory_order_relaxed))
+            _notFullCondition.wait(lock);
         _queue.push_back(std::move(t));
-        
-        // Notify dequeuers if the queue was empty
-        bool notifyDequeuers = _numElements.fetch_add(1) > 0 ? false : true;
-        if (notifyDequeuers)
-            _notEmptyCondition.notify_all();
+        _numElements.store(_queue.size(), std::memory_order_relaxed);
+        _notEmptyCondition.notify_one();
+        lock.unlock();
+
+        if (_notifier)
+            _notifier();
     }
 
+    // Blocks while the queue is empty, returns a default value once the queue is stopped
     T pop()
     {
-        std::unique_lock<std::mutex> lock(_dequeueLock);
-        T val;
-        int numElements(0);
-        while (!_quit.load(std::memory_order_relaxed))
-        {
-            numElements = _numElements.load(std::memory_order_relaxed);
-            while (numElements == 0 && !_quit.load(std::memory_order_relaxed))
-            {
-                _notEmptyCondition.wait(lock);
-                numElements = _numElements.load(std::memory_order_relaxed);
-            }
-            if (_numElements.compare_exchange_weak(numElements, numElements - 1))
-            {
-                val = std::move(_queue.front());
-                _queue.pop_front();
-                return val;
-            }
-        }
-        return val;
+        std::unique_lock<std::mutex> lock(_lock);
+        while (_queue.empty() && !_quit.load(std::memory_order_relaxed))
+            _notEmptyCondition.wait(lock);
+        if (_quit.load(std::memory_order_relaxed))
+            return T();
+
+        return popFront();
+    }
+
+    // Non-blocking pop, returns false if the queue is empty
+    bool tryPop(T& val)
+    {
+        std::lock_guard<std::mutex> lock(_lock);
+        if (_queue.empty())
+            return false;
+
+        val = popFront();
+        return true;
     }
 
     void stop()
     {
-        _quit.store(true, std::memory_order_relaxed);
+        // Set under the lock so a waiter cannot check it and then miss the wake up
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            _quit.store(true, std::memory_order_relaxed);
+        }
         _notEmptyCondition.notify_all();
+        _notFullCondition.notify_all();
+        if (_notifier)
+            _notifier();
+    }
+
+    // Called without the lock after every push and on stop, for a consumer that waits on several
+    // queues at once. Set before the queue is used.
+    void setNotifier(const std::function<void()>& notifier) { _notifier = notifier; }
+
+    const bool isStopped()
+    {
+        return _quit.load(std::memory_order_relaxed);
+    }
+
+    // Read without the lock, for metrics and scheduling hints
+    const int size()
+    {
+        return _numElements.load(std::memory_order_relaxed);
     }
 
 private:
+    // Called with the lock held
+    T popFront()
+    {
+        T val = std::move(_queue.front());
+        _queue.pop_front();
+        _numElements.store(_queue.size(), std::memory_order_relaxed);
+        if (_capacity > 0)
+            _notFullCondition.notify_one();
+        return val;
+    }
+
     std::deque<T> _queue;
-    mutable std::mutex _enqueueLock;
-    mutable std::mutex _dequeueLock;
+    std::mutex _lock;
     std::condition_variable _notEmptyCondition;
+    std::condition_variable _notFullCondition;
+    std::function<void()> _notifier;
+    const int _capacity;
     std::atomic_bool _quit;
     std::atomic_int _numElements;
 };
-
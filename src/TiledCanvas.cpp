@@ -0,0 +1,151 @@
+#include <fstream>
+
+#include "TiledCanvas.hpp"
+
+const std::string TILE_SPILL_EXT = ".tile";
+
+TiledCanvas::TiledCanvas(const cv::Size& size, int type, int tileSize, size_t maxCachedBytes, const std::string& spillDir)
+    : _size(size)
+    , _type(type)
+    , _tileSize(tileSize)
+    , _tilesX((size.width + tileSize - 1) / tileSize)
+    , _tilesY((size.height + tileSize - 1) / tileSize)
+    , _tileBytes(static_cast<size_t>(tileSize) * tileSize * CV_ELEM_SIZE(type))
+    , _maxCachedBytes(maxCachedBytes)
+    , _cachedBytes(0)
+    , _spillDir(spillDir)
+{
+    Tile tile = { cv::Mat(), _lruTiles.end(), false, false, false };
+    _tiles.resize(static_cast<size_t>(_tilesX) * _tilesY, tile);
+}
+
+TiledCanvas::~TiledCanvas()
+{
+    std::error_code err;
+    if (!_spillDir.empty())
+        std::filesystem::remove_all(_spillDir, err);
+}
+
+const cv::Rect TiledCanvas::getTileRect(int tileX, int tileY)
+{
+    cv::Rect rect(tileX * _tileSize, tileY * _tileSize, _tileSize, _tileSize);
+    return rect & cv::Rect(0, 0, _size.width, _size.height);
+}
+
+cv::Mat TiledCanvas::getTile(int tileX, int tileY)
+{
+    int idx = tileY * _tilesX + tileX;
+    Tile& tile = _tiles[idx];
+    if (tile.released)
+    {
+        std::cerr << "Error(TiledCanvas::getTile): Tile " << tileX << "," << tileY << " was already released." << std::endl;
+        return cv::Mat();
+    }
+
+    if (tile.resident)
+    {
+        _lruTiles.splice(_lruTiles.begin(), _lruTiles, tile.lruItr);
+        return tile.pixels;
+    }
+
+    if (!loadTile(idx))
+        return cv::Mat();
+
+    _lruTiles.push_front(idx);
+    tile.lruItr = _lruTiles.begin();
+    tile.resident = true;
+    _cachedBytes += _tileBytes;
+    evictTiles();
+    return tile.pixels;
+}
+
+bool TiledCanvas::releaseTile(int tileX, int tileY, const TileSink& sink)
+{
+    int idx = tileY * _tilesX + tileX;
+    Tile& tile = _tiles[idx];
+    if (tile.released)
+        return true;
+
+    if (!tile.resident && !loadTile(idx))
+        return false;
+
+    bool res = sink(tileX, tileY, tile.pixels);
+    if (tile.resident)
+    {
+        _lruTiles.erase(tile.lruItr);
+        _cachedBytes -= _tileBytes;
+    }
+    if (tile.spilled)
+    {
+        std::error_code err;
+        std::filesystem::remove(getSpillPath(idx), err);
+    }
+
+    tile.pixels.release();
+    tile.resident = false;
+    tile.spilled = false;
+    tile.released = true;
+    return res;
+}
+
+bool TiledCanvas::loadTile(int idx)
+{
+    Tile& tile = _tiles[idx];
+    tile.pixels = cv::Mat::zeros(_tileSize, _tileSize, _type);
+    if (!tile.spilled)
+        return true;
+
+    std::ifstream file(getSpillPath(idx), std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(tile.pixels.data), _tileBytes))
+    {
+        std::cerr << "Error(TiledCanvas::loadTile): Could not read spilled tile - " << getSpillPath(idx) << std::endl;
+        tile.pixels.release();
+        return false;
+    }
+
+    return true;
+}
+
+bool TiledCanvas::spillTile(int idx)
+{
+    if (_spillDir.empty())
+    {
+        std::cerr << "Error(TiledCanvas::spillTile): Tile cache is full and no spill directory is set." << std::endl;
+        return false;
+    }
+
+    std::error_code err;
+    std::filesystem::create_directories(_spillDir, err);
+    std::ofstream file(getSpillPath(idx), std::ios::binary | std::ios::trunc);
+    Tile& tile = _tiles[idx];
+    if (!file.write(reinterpret_cast<const char*>(tile.pixels.data), _tileBytes))
+    {
+        std::cerr << "Error(TiledCanvas::spillTile): Could not write tile - " << getSpillPath(idx) << std::endl;
+        return false;
+    }
+
+    tile.spilled = true;
+    return true;
+}
+
+void TiledCanvas::evictTiles()
+{
+    // The most recently used tile always stays, it is the one the caller is about to write
+    while (_cachedBytes > _maxCachedBytes && _lruTiles.size() > 1)
+    {
+        int idx = _lruTiles.back();
+        if (!spillTile(idx))
+            return;
+
+        Tile& tile = _tiles[idx];
+        _lruTiles.pop_back();
+        tile.pixels.release();
+        tile.resident = false;
+        _cachedBytes -= _tileBytes;
+    }
+}
+
+std::filesystem::path TiledCanvas::getSpillPath(int idx)
+{
+    return _spillDir / (std::to_string(idx) + TILE_SPILL_EXT);
+}
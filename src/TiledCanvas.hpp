@@ -0,0 +1,83 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Canvas split into fixed size tiles, of which only a bounded number of bytes are kept in
+// memory. Least recently used tiles are spilled to raw files on disk and read back when they
+// are needed again, so the canvas can be far larger than memory. Edge tiles are padded to the
+// full tile size. Not thread safe, each worker composites its own canvas.
+class TiledCanvas
+{
+public:
+    typedef std::function<bool(int tileX, int tileY, const cv::Mat& tile)> TileSink;
+
+    TiledCanvas(const cv::Size& size, int type, int tileSize, size_t maxCachedBytes, const std::string& spillDir);
+    ~TiledCanvas();
+
+    const cv::Size getSize() { return _size; }
+    const int getType() { return _type; }
+    const int getTileSize() { return _tileSize; }
+    const int getTilesX() { return _tilesX; }
+    const int getTilesY() { return _tilesY; }
+
+    // Canvas area covered by the tile, clipped to the canvas size
+    const cv::Rect getTileRect(int tileX, int tileY);
+
+    // Tiles start out zeroed. Write to a tile before requesting the next one, it may be
+    // spilled to disk once it is no longer the most recently used tile.
+    cv::Mat getTile(int tileX, int tileY);
+
+    // Hands a finished tile to the sink and frees its memory and spill file. Released
+    // tiles cannot be requested again.
+    bool releaseTile(int tileX, int tileY, const TileSink& sink);
+    const bool isReleased(int tileX, int tileY) { return _tiles[tileY * _tilesX + tileX].released; }
+
+private:
+    struct Tile
+    {
+        cv::Mat pixels;
+        std::list<int>::iterator lruItr;
+        bool resident;
+        bool spilled;
+        bool released;
+    };
+
+    bool loadTile(int idx);
+    bool spillTile(int idx);
+    void evictTiles();
+    std::filesystem::path getSpillPath(int idx);
+
+    cv::Size _size;
+    int _type;
+    int _tileSize;
+    int _tilesX;
+    int _tilesY;
+    size_t _tileBytes;
+    size_t _maxCachedBytes;
+    size_t _cachedBytes;
+    std::filesystem::path _spillDir;
+    std::vector<Tile> _tiles;
+    std::list<int> _lruTiles; // Most recently used at the front
+};
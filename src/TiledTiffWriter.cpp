@@ -0,0 +1,226 @@
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+#include "TiledTiffWriter.hpp"
+
+const uint16_t TIFF_SHORT = 3;
+const uint16_t TIFF_LONG = 4;
+const uint16_t TIFF_LONG8 = 16;
+const uint64_t CLASSIC_TIFF_MAX_BYTES = 0xFFFFFFFFull - (64ull << 20); // Headroom for the tables
+
+// Header values and pixels are written in host byte order, which the byte order mark records
+bool isLittleEndianHost()
+{
+    const uint16_t probe = 1;
+    return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+template <typename T> void TiledTiffWriter::write(T val)
+{
+    _file.write(reinterpret_cast<const char*>(&val), sizeof(val));
+}
+
+template <typename T> TiledTiffWriter::IfdEntry TiledTiffWriter::makeEntry(uint16_t tag, uint16_t type, const std::vector<T>& vals)
+{
+    IfdEntry entry = { tag, type, vals.size(), std::vector<uint8_t>(vals.size() * sizeof(T)) };
+    std::memcpy(entry.data.data(), vals.data(), entry.data.size());
+    return entry;
+}
+
+void TiledTiffWriter::writeOffset(uint64_t offset)
+{
+    if (_bigTiff)
+        write<uint64_t>(offset);
+    else
+        write<uint32_t>(static_cast<uint32_t>(offset));
+}
+
+const bool TiledTiffWriter::isSupportedType(int type)
+{
+    int depth = CV_MAT_DEPTH(type);
+    int channels = CV_MAT_CN(type);
+    return (depth == CV_8U || depth == CV_16U) && (channels == 1 || channels == 3 || channels == 4);
+}
+
+bool TiledTiffWriter::open(const std::string& path, const cv::Size& size, int type, int tileSize)
+{
+    if (!isSupportedType(type) || tileSize <= 0 || tileSize % 16 != 0 || size.width <= 0 || size.height <= 0)
+    {
+        std::cerr << "Error(TiledTiffWriter::open): Unsupported image type or tile size for - " << path << std::endl;
+        return false;
+    }
+
+    _file.open(path, std::ios::binary | std::ios::trunc);
+    if (!_file)
+    {
+        std::cerr << "Error(TiledTiffWriter::open): Could not open - " << path << std::endl;
+        return false;
+    }
+
+    _path = path;
+    _size = size;
+    _type = type;
+    _tileSize = tileSize;
+    _tilesX = (size.width + tileSize - 1) / tileSize;
+    _tilesY = (size.height + tileSize - 1) / tileSize;
+    _tileOffsets.assign(static_cast<size_t>(_tilesX) * _tilesY, 0);
+    uint64_t tileBytes = static_cast<uint64_t>(tileSize) * tileSize * CV_ELEM_SIZE(type);
+    _bigTiff = tileBytes * _tileOffsets.size() > CLASSIC_TIFF_MAX_BYTES;
+
+    // The first IFD offset is patched in on close
+    _file.write(isLittleEndianHost() ? "II" : "MM", 2);
+    if (_bigTiff)
+    {
+        write<uint16_t>(43);
+        write<uint16_t>(8);
+        write<uint16_t>(0);
+        write<uint64_t>(0);
+    }
+    else
+    {
+        write<uint16_t>(42);
+        write<uint32_t>(0);
+    }
+
+    return static_cast<bool>(_file);
+}
+
+bool TiledTiffWriter::writeTile(int tileX, int tileY, const cv::Mat& tile)
+{
+    if (!_file.is_open() || tileX < 0 || tileY < 0 || tileX >= _tilesX || tileY >= _tilesY ||
+        tile.type() != _type || tile.rows != _tileSize || tile.cols != _tileSize)
+    {
+        std::cerr << "Error(TiledTiffWriter::writeTile): Invalid tile " << tileX << "," << tileY << " for - " << _path << std::endl;
+        return false;
+    }
+
+    // TIFF stores RGB(A)
+    const cv::Mat* pixels = &tile;
+    if (tile.channels() == 3)
+    {
+        cv::cvtColor(tile, _tileBuffer, cv::COLOR_BGR2RGB);
+        pixels = &_tileBuffer;
+    }
+    else if (tile.channels() == 4)
+    {
+        cv::cvtColor(tile, _tileBuffer, cv::COLOR_BGRA2RGBA);
+        pixels = &_tileBuffer;
+    }
+    else if (!tile.isContinuous())
+    {
+        _tileBuffer = tile.clone();
+        pixels = &_tileBuffer;
+    }
+
+    _tileOffsets[tileY * _tilesX + tileX] = static_cast<uint64_t>(_file.tellp());
+    _file.write(reinterpret_cast<const char*>(pixels->data), pixels->total() * pixels->elemSize());
+    return static_cast<bool>(_file);
+}
+
+bool TiledTiffWriter::close()
+{
+    if (!_file.is_open())
+        return true;
+
+    // Tiles that were never written share one blank tile
+    uint64_t tileBytes = static_cast<uint64_t>(_tileSize) * _tileSize * CV_ELEM_SIZE(_type);
+    if (std::find(_tileOffsets.begin(), _tileOffsets.end(), 0) != _tileOffsets.end())
+    {
+        uint64_t blankOffset = static_cast<uint64_t>(_file.tellp());
+        std::vector<char> blank(tileBytes, 0);
+        _file.write(blank.data(), blank.size());
+        std::replace(_tileOffsets.begin(), _tileOffsets.end(), uint64_t(0), blankOffset);
+    }
+
+    int channels = CV_MAT_CN(_type);
+    uint16_t bitsPerSample = CV_MAT_DEPTH(_type) == CV_16U ? 16 : 8;
+    std::vector<IfdEntry> entries;
+    entries.push_back(makeEntry<uint32_t>(256, TIFF_LONG, { static_cast<uint32_t>(_size.width) }));
+    entries.push_back(makeEntry<uint32_t>(257, TIFF_LONG, { static_cast<uint32_t>(_size.height) }));
+    entries.push_back(makeEntry<uint16_t>(258, TIFF_SHORT, std::vector<uint16_t>(channels, bitsPerSample)));
+    entries.push_back(makeEntry<uint16_t>(259, TIFF_SHORT, { 1 })); // No compression
+    entries.push_back(makeEntry<uint16_t>(262, TIFF_SHORT, { static_cast<uint16_t>(channels == 1 ? 1 : 2) }));
+    entries.push_back(makeEntry<uint16_t>(277, TIFF_SHORT, { static_cast<uint16_t>(channels) }));
+    entries.push_back(makeEntry<uint16_t>(284, TIFF_SHORT, { 1 })); // Chunky
+    entries.push_back(makeEntry<uint32_t>(322, TIFF_LONG, { static_cast<uint32_t>(_tileSize) }));
+    entries.push_back(makeEntry<uint32_t>(323, TIFF_LONG, { static_cast<uint32_t>(_tileSize) }));
+    if (_bigTiff)
+    {
+        entries.push_back(makeEntry<uint64_t>(324, TIFF_LONG8, _tileOffsets));
+        entries.push_back(makeEntry<uint64_t>(325, TIFF_LONG8, std::vector<uint64_t>(_tileOffsets.size(), tileBytes)));
+    }
+    else
+    {
+        entries.push_back(makeEntry<uint32_t>(324, TIFF_LONG, std::vector<uint32_t>(_tileOffsets.begin(), _tileOffsets.end())));
+        entries.push_back(makeEntry<uint32_t>(325, TIFF_LONG, std::vector<uint32_t>(_tileOffsets.size(), tileBytes)));
+    }
+    if (channels == 4)
+        entries.push_back(makeEntry<uint16_t>(338, TIFF_SHORT, { 2 })); // Unassociated alpha
+
+    // Values that don't fit in an entry go before the IFD, on word boundaries
+    size_t inlineBytes = _bigTiff ? 8 : 4;
+    std::vector<uint64_t> valueOffsets(entries.size(), 0);
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (entries[i].data.size() <= inlineBytes)
+            continue;
+
+        if (_file.tellp() % 2)
+            _file.put(0);
+        valueOffsets[i] = static_cast<uint64_t>(_file.tellp());
+        _file.write(reinterpret_cast<const char*>(entries[i].data.data()), entries[i].data.size());
+    }
+
+    if (_file.tellp() % 2)
+        _file.put(0);
+    uint64_t ifdOffset = static_cast<uint64_t>(_file.tellp());
+    if (_bigTiff)
+        write<uint64_t>(entries.size());
+    else
+        write<uint16_t>(static_cast<uint16_t>(entries.size()));
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        write<uint16_t>(entries[i].tag);
+        write<uint16_t>(entries[i].type);
+        if (_bigTiff)
+            write<uint64_t>(entries[i].count);
+        else
+            write<uint32_t>(static_cast<uint32_t>(entries[i].count));
+
+        if (valueOffsets[i] != 0)
+        {
+            writeOffset(valueOffsets[i]);
+        }
+        else
+        {
+            std::vector<uint8_t> value(inlineBytes, 0);
+            std::copy(entries[i].data.begin(), entries[i].data.end(), value.begin());
+            _file.write(reinterpret_cast<const char*>(value.data()), value.size());
+        }
+    }
+    writeOffset(0); // No more IFDs
+
+    _file.seekp(_bigTiff ? 8 : 4);
+    writeOffset(ifdOffset);
+    bool res = static_cast<bool>(_file);
+    _file.close();
+    if (!res)
+    {
+        std::cerr << "Error(TiledTiffWriter::close): Failed to write - " << _path << std::endl;
+        std::error_code err;
+        std::filesystem::remove(_path, err);
+    }
+
+    return res;
+}
+
+void TiledTiffWriter::abort()
+{
+    if (!_file.is_open())
+        return;
+
+    _file.close();
+    std::error_code err;
+    std::filesystem::remove(_path, err);
+}
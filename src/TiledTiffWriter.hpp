@@ -0,0 +1,73 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Streams an uncompressed tiled TIFF to disk one tile at a time, so the whole image never has
+// to be in memory. Tiles can be written in any order, the tile table is written on close.
+// A writer that is not closed removes its file, so an incomplete image is never left behind.
+// Switches to BigTIFF when the image does not fit the 4GB classic TIFF offsets.
+// Supports 8 and 16 bit images with 1, 3 or 4 channels, in OpenCV's BGR(A) channel order.
+class TiledTiffWriter
+{
+public:
+    TiledTiffWriter()
+        : _type(0)
+        , _tileSize(0)
+        , _tilesX(0)
+        , _tilesY(0)
+        , _bigTiff(false)
+    {}
+    ~TiledTiffWriter() { abort(); }
+
+    static const bool isSupportedType(int type);
+
+    // Tile size must be a multiple of 16
+    bool open(const std::string& path, const cv::Size& size, int type, int tileSize);
+    bool writeTile(int tileX, int tileY, const cv::Mat& tile);
+    bool close();
+    void abort();
+
+private:
+    struct IfdEntry
+    {
+        uint16_t tag;
+        uint16_t type;
+        uint64_t count;
+        std::vector<uint8_t> data;
+    };
+
+    template <typename T> void write(T val);
+    template <typename T> IfdEntry makeEntry(uint16_t tag, uint16_t type, const std::vector<T>& vals);
+    void writeOffset(uint64_t offset);
+
+    std::ofstream _file;
+    std::string _path;
+    cv::Size _size;
+    int _type;
+    int _tileSize;
+    int _tilesX;
+    int _tilesY;
+    bool _bigTiff;
+    std::vector<uint64_t> _tileOffsets; // 0 until the tile is written
+    cv::Mat _tileBuffer;
+};
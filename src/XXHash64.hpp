@@ -0,0 +1,150 @@
+/***
+ParallelPanorama: Concurrently stitches together images from files and displays them.
+Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 3 of the License, or
+   (at your option) any later version.
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software Foundation,
+   Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA
+***/
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// Streaming implementation of the 64-bit xxHash algorithm
+class XXHash64
+{
+public:
+    XXHash64(uint64_t seed = 0)
+        : _totalLen(0)
+        , _bufferLen(0)
+    {
+        _acc[0] = seed + PRIME_1 + PRIME_2;
+        _acc[1] = seed + PRIME_2;
+        _acc[2] = seed;
+        _acc[3] = seed - PRIME_1;
+        _seed = seed;
+    }
+
+    void update(const void* data, size_t len)
+    {
+        const unsigned char* input = static_cast<const unsigned char*>(data);
+        _totalLen += len;
+
+        // Top up a partially filled stripe first
+        if (_bufferLen > 0)
+        {
+            size_t fill = std::min(len, STRIPE_LEN - _bufferLen);
+            std::memcpy(_buffer + _bufferLen, input, fill);
+            _bufferLen += fill;
+            input += fill;
+            len -= fill;
+            if (_bufferLen < STRIPE_LEN)
+                return;
+
+            consumeStripe(_buffer);
+            _bufferLen = 0;
+        }
+
+        for (; len >= STRIPE_LEN; input += STRIPE_LEN, len -= STRIPE_LEN)
+            consumeStripe(input);
+
+        if (len > 0)
+        {
+            std::memcpy(_buffer, input, len);
+            _bufferLen = len;
+        }
+    }
+
+    template <typename T> void update(const T& value) { update(&value, sizeof(T)); }
+
+    const uint64_t digest()
+    {
+        uint64_t hash;
+        if (_totalLen >= STRIPE_LEN)
+        {
+            hash = rotl(_acc[0], 1) + rotl(_acc[1], 7) + rotl(_acc[2], 12) + rotl(_acc[3], 18);
+            for (int i = 0; i < 4; i++)
+                hash = mergeRound(hash, _acc[i]);
+        }
+        else
+        {
+            hash = _seed + PRIME_5;
+        }
+        hash += _totalLen;
+
+        const unsigned char* input = _buffer;
+        size_t len = _bufferLen;
+        for (; len >= 8; input += 8, len -= 8)
+        {
+            hash ^= round(0, read64(input));
+            hash = rotl(hash, 27) * PRIME_1 + PRIME_4;
+        }
+        if (len >= 4)
+        {
+            hash ^= static_cast<uint64_t>(read32(input)) * PRIME_1;
+            hash = rotl(hash, 23) * PRIME_2 + PRIME_3;
+            input += 4;
+            len -= 4;
+        }
+        for (; len > 0; input++, len--)
+        {
+            hash ^= (*input) * PRIME_5;
+            hash = rotl(hash, 11) * PRIME_1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME_2;
+        hash ^= hash >> 29;
+        hash *= PRIME_3;
+        hash ^= hash >> 32;
+        return hash;
+    }
+
+private:
+    static const uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    static const uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    static const uint64_t PRIME_3 = 0x165667B19E3779F9ULL;
+    static const uint64_t PRIME_4 = 0x85EBCA77C2B2AE63ULL;
+    static const uint64_t PRIME_5 = 0x27D4EB2F165667C5ULL;
+    static const size_t STRIPE_LEN = 32;
+
+    static uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+    static uint64_t read64(const unsigned char* p) { uint64_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+    static uint32_t read32(const unsigned char* p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * PRIME_2;
+        acc = rotl(acc, 31);
+        return acc * PRIME_1;
+    }
+
+    static uint64_t mergeRound(uint64_t acc, uint64_t val)
+    {
+        acc ^= round(0, val);
+        return acc * PRIME_1 + PRIME_4;
+    }
+
+    void consumeStripe(const unsigned char* stripe)
+    {
+        for (int i = 0; i < 4; i++)
+            _acc[i] = round(_acc[i], read64(stripe + i * 8));
+    }
+
+    uint64_t _acc[4];
+    uint64_t _seed;
+    uint64_t _totalLen;
+    unsigned char _buffer[STRIPE_LEN];
+    size_t _bufferLen;
+};
@@ -18,176 +18,602 @@ Copyright (C) 2020 Braedon Dickerson and Amir Kimiyaie
 #include <chrono>
 #include <thread>
 #include <filesystem>
+#include <future>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
 #include "ImageStitcher.hpp"
 #include "ImageLoader.hpp"
-#include "StitcherWorker.hpp"
+#include "StitchSession.hpp"
 #include "ThreadSafeDequeue.hpp"
+#include "ResultCache.hpp"
+#include "RigCalibration.hpp"
+#include "Metrics.hpp"
+#ifdef USE_SHM
+#include "ShmChannel.hpp"
+#endif
 
 bool QUIT_PROCESSING = false;
 const float DISPLAY_PERCENTAGE = 0.3;
+const float SHM_RESULT_SLOT_HEADROOM = 1.5; // The OpenCV stitcher can warp the panorama taller than its inputs
+const std::chrono::milliseconds PREVIEW_POLL_INTERVAL(5);
 unsigned long TOTAL_STITCH_TIME = 0;
 unsigned long TOTAL_FINAL_STITCHES = 0;
-std::chrono::high_resolution_clock TIME;
+std::chrono::steady_clock TIME;
 std::chrono::steady_clock::time_point START_TIME;
 
-bool stitchAllImgs(ThreadSafeDequeue<JobIdPair>& jobQueue,
-                   ThreadSafeDequeue<ResIdPair>& resQueue,
+bool stitchAllImgs(StitchSession& session,
+                   ThreadSafeDequeue<ResIdPair>* previewQueue,
                    ImageLoader& imgLoader,
+                   float outputScale,
+                   float previewScale,
+                   const std::string& outputDir,
+                   MetricsRegistry* metrics,
                    const bool& quit);
 
+void outputResult(ResIdPair& res, float resultScale, const std::string& outputDir, bool display);
+
 void printUsage();
 
 int main(int argc, char* argv[])
 {
-    if (argc != 4) {
+    if (argc < 4) {
         printUsage();
         return 1;
     }
 
+    // Parse the optional flags that follow the positional arguments
+    int imreadFlags = cv::IMREAD_COLOR;
+    std::string cacheDir;
+    unsigned long cacheSizeMb = 1024;
+    std::string calibrationPath;
+    std::string exportCalibrationPath;
+    bool exportWarpMaps = false;
+    float outputScale = 0.0;
+    std::string outputDir;
+    bool progressive = false;
+    std::string shmName;
+    std::string shmAttachName;
+    unsigned int shmJobs = 8;
+    std::string metricsFile;
+    std::string metricsSocket;
+    float metricsInterval = 5.0;
+    bool tiledTiff = false;
+    unsigned long tileCacheMb = 256;
+    int registrationScale = 1;
+    unsigned int registrationThreads = 0;
+    unsigned int pipelineDepth = 4;
+    bool incremental = false;
+    unsigned int intraOpThreads = 0;
+
+    // Worker processes attached to a shared memory channel get their images from the channel
+    std::string imgDirPath(argv[3]);
+    int firstOptionIdx = 4;
+    if (imgDirPath.rfind("--", 0) == 0)
+    {
+        imgDirPath.clear();
+        firstOptionIdx = 3;
+    }
+    for (int i = firstOptionIdx; i < argc; i++)
+    {
+        std::string arg(argv[i]);
+        size_t valueIdx = arg.find('=');
+        std::string value = valueIdx != std::string::npos ? arg.substr(valueIdx + 1) : "";
+        arg = arg.substr(0, valueIdx);
+        if (arg == "--native-pixels")
+        {
+            imreadFlags = cv::IMREAD_UNCHANGED;
+        }
+        else if (arg == "--cache-dir" && !value.empty())
+        {
+            cacheDir = value;
+        }
+        else if (arg == "--cache-size-mb" && !value.empty())
+        {
+            cacheSizeMb = std::stoul(value);
+        }
+        else if (arg == "--calibration" && !value.empty())
+        {
+            calibrationPath = value;
+        }
+        else if (arg == "--export-calibration" && !value.empty())
+        {
+            exportCalibrationPath = value;
+        }
+        else if (arg == "--export-warp-maps")
+        {
+            exportWarpMaps = true;
+        }
+        else if (arg == "--output-scale" && !value.empty())
+        {
+            outputScale = std::stof(value);
+        }
+        else if (arg == "--output-dir" && !value.empty())
+        {
+            outputDir = value;
+        }
+        else if (arg == "--progressive")
+        {
+            progressive = true;
+        }
+        else if (arg == "--shm-name" && !value.empty())
+        {
+            shmName = value;
+        }
+        else if (arg == "--shm-attach" && !value.empty())
+        {
+            shmAttachName = value;
+        }
+        else if (arg == "--shm-jobs" && !value.empty())
+        {
+            shmJobs = std::stoul(value);
+        }
+        else if (arg == "--tiled-tiff")
+        {
+            tiledTiff = true;
+        }
+        else if (arg == "--tile-cache-mb" && !value.empty())
+        {
+            tileCacheMb = std::stoul(value);
+        }
+        else if (arg == "--registration-scale" && !value.empty())
+        {
+            registrationScale = std::stoi(value);
+        }
+        else if (arg == "--incremental")
+        {
+            incremental = true;
+        }
+        else if (arg == "--intra-op-threads" && !value.empty())
+        {
+            intraOpThreads = std::stoul(value);
+        }
+        else if (arg == "--registration-threads" && !value.empty())
+        {
+            registrationThreads = std::stoul(value);
+        }
+        else if (arg == "--pipeline-depth" && !value.empty())
+        {
+            pipelineDepth = std::stoul(value);
+        }
+        else if (arg == "--metrics-file" && !value.empty())
+        {
+            metricsFile = value;
+        }
+        else if (arg == "--metrics-socket" && !value.empty())
+        {
+            metricsSocket = value;
+        }
+        else if (arg == "--metrics-interval" && !value.empty())
+        {
+            metricsInterval = std::stof(value);
+        }
+        else
+        {
+            std::cerr << "Error(main): Unknown option - " << arg << std::endl;
+            printUsage();
+            return 1;
+        }
+    }
+
+    // Only composite at full resolution when the full resolution images are actually kept,
+    // or registered for an exported calibration
+    if (outputScale == 0.0)
+        outputScale = outputDir.empty() && exportCalibrationPath.empty() ? DISPLAY_PERCENTAGE : 1.0;
+    if (outputScale <= 0.0 || outputScale > 1.0)
+    {
+        std::cerr << "Error(main): Output scale must be greater than 0 and at most 1." << std::endl;
+        return 1;
+    }
+    if (progressive && outputDir.empty())
+    {
+        std::cerr << "Error(main): Progressive output requires an output directory for the full images." << std::endl;
+        return 1;
+    }
+    if (!exportCalibrationPath.empty() && outputScale != 1.0)
+    {
+        std::cerr << "Error(main): Exporting a calibration requires full resolution output (--output-scale=1)." << std::endl;
+        return 1;
+    }
+    bool useShm = !shmName.empty() || !shmAttachName.empty();
+#ifndef USE_SHM
+    if (useShm)
+    {
+        std::cerr << "Error(main): Shared memory workers are not supported on this platform." << std::endl;
+        return 1;
+    }
+#endif
+    if (!shmName.empty() && !shmAttachName.empty())
+    {
+        std::cerr << "Error(main): A process either creates (--shm-name) or attaches to (--shm-attach) a shared memory channel." << std::endl;
+        return 1;
+    }
+    if (useShm && (progressive || shmJobs == 0))
+    {
+        std::cerr << "Error(main): Shared memory workers need at least one job slot and do not support progressive output." << std::endl;
+        return 1;
+    }
+    if (imgDirPath.empty() && shmAttachName.empty())
+    {
+        printUsage();
+        return 1;
+    }
+    if (tiledTiff && (outputDir.empty() || progressive || !cacheDir.empty() ||
+                      !calibrationPath.empty() || !exportCalibrationPath.empty()))
+    {
+        std::cerr << "Error(main): Tiled TIFF output requires --output-dir and does not support progressive output, "
+                  << "the result cache or calibrations." << std::endl;
+        return 1;
+    }
+    if (!ImageLoader::isValidRegistrationScale(registrationScale))
+    {
+        std::cerr << "Error(main): Registration scale must be 1, 2, 4 or 8." << std::endl;
+        return 1;
+    }
+    if (!outputDir.empty())
+        std::filesystem::create_directories(outputDir);
+    float previewScale = std::min(DISPLAY_PERCENTAGE, outputScale);
+
     unsigned int numStitcherWorkerThreads = std::stoul(argv[1]);
     if (numStitcherWorkerThreads == 0 || numStitcherWorkerThreads > std::thread::hardware_concurrency())
     {
         std::cerr << "Error(main): Number of workers threads must be between 1 and <number-of-physical-cores>.";
         return 1;
     }
+    if (intraOpThreads > std::thread::hardware_concurrency())
+    {
+        std::cerr << "Error(main): Number of intra-op threads must be at most <number-of-physical-cores>." << std::endl;
+        return 1;
+    }
+    if (registrationThreads > std::thread::hardware_concurrency() || pipelineDepth == 0)
+    {
+        std::cerr << "Error(main): Number of registration threads must be at most <number-of-physical-cores> "
+                  << "and the pipeline depth at least 1." << std::endl;
+        return 1;
+    }
 
     // Setup stitcher mode
     ImageStitcher::StitcherMode stitchMode = ImageStitcher::StitcherMode_Manual;
     if (std::string(argv[2]).find("opencv") != std::string::npos)
         stitchMode = ImageStitcher::StitcherMode_OpenCV;
+    if (tiledTiff && stitchMode != ImageStitcher::StitcherMode_Manual)
+    {
+        std::cerr << "Error(main): Tiled TIFF output is only supported by the manual stitcher." << std::endl;
+        return 1;
+    }
+    if (registrationScale > 1 && stitchMode != ImageStitcher::StitcherMode_Manual)
+    {
+        std::cerr << "Error(main): Reduced registration images are only supported by the manual stitcher." << std::endl;
+        return 1;
+    }
+
+    if (incremental && (stitchMode != ImageStitcher::StitcherMode_Manual || tiledTiff || progressive))
+    {
+        std::cerr << "Error(main): Incremental compositing is only supported by the manual stitcher without tiled or progressive output." << std::endl;
+        return 1;
+    }
+    if (incremental && !cacheDir.empty())
+    {
+        std::cerr << "Error(main): Incremental composites depend on earlier image groups and cannot be cached." << std::endl;
+        return 1;
+    }
+    if (registrationThreads > 0 && stitchMode != ImageStitcher::StitcherMode_Manual)
+    {
+        std::cerr << "Error(main): Pipelined registration is only supported by the manual stitcher." << std::endl;
+        return 1;
+    }
 
     // Load images
-    ImageLoader initImgLoader;
-    for (const auto& entry : std::filesystem::directory_iterator(argv[3]))
+    ImageLoader initImgLoader(imreadFlags, registrationScale);
+    if (!imgDirPath.empty())
     {
-        if (!initImgLoader.loadImages(entry.path().string()))
-            std::cerr << "Error(main): Failed to load images from directory - " << entry.path() << std::endl;
-        else
-            std::cout << "Loaded images from - " << entry.path() << std::endl;
+        for (const auto& entry : std::filesystem::directory_iterator(imgDirPath))
+        {
+            if (!initImgLoader.loadImages(entry.path().string()))
+                std::cerr << "Error(main): Failed to load images from directory - " << entry.path() << std::endl;
+            else
+                std::cout << "Loaded images from - " << entry.path() << std::endl;
+        }
     }
 
-    // Setup stitcher worker threads and start them
-    ThreadSafeDequeue<JobIdPair> jobQueue;
-    ThreadSafeDequeue<ResIdPair> resQueue;
-    std::vector<std::pair<std::thread, StitcherWorker>> stitcherWorkers;
-    for (int i = 0; i < numStitcherWorkerThreads; i++)
+#ifdef USE_SHM
+    // Setup the shared memory channel, sized so any loaded image fits a frame slot
+    ShmChannel shmChannel;
+    if (!shmName.empty())
     {
-        StitcherWorker stitcherWorker(jobQueue, resQueue, stitchMode);
-        std::thread workerThread(&StitcherWorker::run, stitcherWorker);
-        stitcherWorkers.emplace_back(std::pair<std::thread, StitcherWorker>(std::move(workerThread), std::move(stitcherWorker)));
+        size_t maxFrameBytes(0);
+        std::vector<ImgIdPair> imgPairs;
+        initImgLoader.getImgPairs(imgPairs);
+        for (const auto& imgPair : imgPairs)
+        {
+            for (const auto& img : *imgPair.second)
+                maxFrameBytes = std::max(maxFrameBytes, img.total() * img.elemSize());
+        }
+
+        // Jobs carry a reduced registration image per camera on top of the full images
+        unsigned int numCameras = initImgLoader.getMaxImgId();
+        unsigned int framesPerJob = registrationScale > 1 ? numCameras * 2 : numCameras;
+        size_t resultSlotBytes = numCameras * maxFrameBytes * outputScale * outputScale * SHM_RESULT_SLOT_HEADROOM;
+        if (!shmChannel.create(shmName, maxFrameBytes, framesPerJob, resultSlotBytes, shmJobs, outputScale, registrationScale))
+        {
+            std::cerr << "Error(main): Failed to create shared memory channel - " << shmName << std::endl;
+            return 1;
+        }
+        std::cout << "Created shared memory channel - " << shmName << std::endl;
     }
+    else if (!shmAttachName.empty())
+    {
+        if (!shmChannel.attach(shmAttachName))
+        {
+            std::cerr << "Error(main): Failed to attach to shared memory channel - " << shmAttachName << std::endl;
+            return 1;
+        }
+        outputScale = shmChannel.getOutputScale();
+        registrationScale = shmChannel.getRegistrationScale();
+        std::cout << "Attached to shared memory channel - " << shmAttachName << std::endl;
+    }
+#endif
 
-    // Send all stitch jobs
-    if (!stitchAllImgs(jobQueue, resQueue, initImgLoader, QUIT_PROCESSING))
+    // Setup the optional result cache shared by all workers
+    std::shared_ptr<ResultCache> resultCache;
+    if (!cacheDir.empty())
     {
-        std::cerr << "Error(main): Could not stitch images!" << std::endl;
+        resultCache = std::make_shared<ResultCache>(cacheDir, static_cast<uintmax_t>(cacheSizeMb) * 1024 * 1024);
+        if (!resultCache->isValid())
+        {
+            std::cerr << "Error(main): Failed to open result cache - " << cacheDir << std::endl;
+            return 1;
+        }
+    }
+
+    // Load the rig calibration, or prepare to export one from the first registered job
+    std::shared_ptr<RigCalibration> calibration;
+    if (!calibrationPath.empty())
+    {
+        calibration = std::make_shared<RigCalibration>();
+        if (!calibration->load(calibrationPath))
+        {
+            std::cerr << "Error(main): Failed to load rig calibration - " << calibrationPath << std::endl;
+            return 1;
+        }
+    }
+    std::shared_ptr<RigCalibration> calibrationExport;
+    if (!exportCalibrationPath.empty())
+        calibrationExport = std::make_shared<RigCalibration>();
+
+    // Setup the optional metrics registry shared by the workers and the result loop
+    std::shared_ptr<MetricsRegistry> metrics;
+    if (!metricsFile.empty() || !metricsSocket.empty())
+        metrics = std::make_shared<MetricsRegistry>();
+
+    // Setup the stitching session. With a shared memory channel the local workers take their jobs
+    // from the channel like the workers of any other process. With registration threads, those
+    // register the jobs and the stitcher worker threads only composite them.
+    StitchSessionOptions sessionOptions;
+    sessionOptions.numWorkers = numStitcherWorkerThreads;
+    sessionOptions.registrationThreads = registrationThreads;
+    sessionOptions.pipelineDepth = pipelineDepth;
+    sessionOptions.intraOpThreads = intraOpThreads;
+    sessionOptions.stitcherMode = stitchMode;
+    sessionOptions.outputScale = outputScale;
+    sessionOptions.previewScale = progressive || tiledTiff ? previewScale : 0.0f;
+    sessionOptions.registrationScale = registrationScale;
+    sessionOptions.incremental = incremental;
+    if (tiledTiff)
+        sessionOptions.tiledOutputDir = outputDir;
+    sessionOptions.tileCacheBytes = static_cast<size_t>(tileCacheMb) * 1024 * 1024;
+    sessionOptions.resultCache = resultCache;
+    sessionOptions.calibration = calibration;
+    sessionOptions.calibrationExport = calibrationExport;
+    sessionOptions.calibrationExportPath = exportCalibrationPath;
+    sessionOptions.exportWarpMaps = exportWarpMaps;
+    sessionOptions.metrics = metrics;
+
+    // Previews are shown by the main thread, which owns the display
+    ThreadSafeDequeue<ResIdPair> previewQueue;
+    StitchSession session(sessionOptions);
+    if (progressive)
+    {
+        session.setPreviewCallback([&previewQueue](unsigned int frameId, const cv::Mat& img) {
+            ResIdPair preview(frameId, img);
+            previewQueue.push(preview);
+        });
+    }
+
+    bool started(false);
+#ifdef USE_SHM
+    if (useShm)
+        started = session.start(shmChannel, !shmName.empty());
+    else
+#endif
+        started = session.start();
+    if (!started)
+    {
+        std::cerr << "Error(main): Failed to start the stitching session." << std::endl;
         return 1;
     }
 
-    // Make sure the workers are done
-    for (auto& worker : stitcherWorkers)
+    // Export the metrics once all the queues they sample exist
+    std::unique_ptr<MetricsExporter> metricsExporter;
+    if (metrics)
     {
-        worker.second.quit();
-        worker.first.join();
+        auto interval = std::chrono::milliseconds(static_cast<long>(std::max(metricsInterval, 0.1f) * 1000));
+        metricsExporter = std::make_unique<MetricsExporter>(metrics, metricsFile, metricsSocket, interval);
+        if (!metricsExporter->start())
+        {
+            std::cerr << "Error(main): Failed to start exporting metrics." << std::endl;
+            return 1;
+        }
+    }
+
+    // Send all stitch jobs, worker processes only serve the channel until the coordinator stops it
+    bool stitched(true);
+#ifdef USE_SHM
+    if (!shmAttachName.empty())
+        session.waitForChannel();
+    else
+#endif
+        stitched = stitchAllImgs(session, progressive ? &previewQueue : nullptr, initImgLoader,
+                                 tiledTiff ? previewScale : outputScale, previewScale, tiledTiff ? "" : outputDir,
+                                 metrics.get(), QUIT_PROCESSING);
+
+    // The exporter's last snapshot still holds the session's gauges
+    metricsExporter.reset();
+    session.stop();
+
+    if (!stitched)
+    {
+        std::cerr << "Error(main): Could not stitch images!" << std::endl;
+        return 1;
     }
 
     return 0;
 }
 
 
-bool stitchAllImgs(ThreadSafeDequeue<JobIdPair>& jobQueue,
-                   ThreadSafeDequeue<ResIdPair>& resQueue,
+bool stitchAllImgs(StitchSession& session,
+                   ThreadSafeDequeue<ResIdPair>* previewQueue,
                    ImageLoader& imgLoader,
+                   float outputScale,
+                   float previewScale,
+                   const std::string& outputDir,
+                   MetricsRegistry* metrics,
                    const bool& quit)
 {
-    // Send all the images to the job queue to be stitched together
+    // Frame latency runs from sending a job to outputting its result, so it includes queueing
+    LatencyHistogram localFrameLatency;
+    LatencyHistogram* frameLatency = &localFrameLatency;
+    MetricCounter* outputFrames = nullptr;
+    if (metrics)
+    {
+        frameLatency = &metrics->getHistogram("parallelpanorama_frame_latency_seconds",
+                                              "Time from sending an image group to outputting its stitched image.");
+        outputFrames = &metrics->getCounter("parallelpanorama_output_frames_total",
+                                            "Stitched images written or displayed.");
+    }
+    std::vector<std::chrono::steady_clock::time_point> enqueueTimes;
+
+    // Submit all the images to the session to be stitched together
     std::cout << "Sending all stitch jobs to job queue." << std::endl;
-    unsigned int jobId(0);
+    std::vector<std::future<cv::Mat>> results;
     while (!quit)
     {
         // Acquire the next group of images to stitch together
         std::vector<cv::Mat> curImages;
+        std::vector<cv::Mat> curRegImages;
         for (int i = 0; i < imgLoader.getMaxImgId(); i++)
         {
             cv::Mat img;
-            if (!imgLoader.popImage(i + 1, img))
+            cv::Mat regImg;
+            if (!imgLoader.popImage(i + 1, img, regImg))
                 break;
 
             curImages.push_back(std::move(img));
+            curRegImages.push_back(std::move(regImg));
         }
 
         // Check if we're done acquiring images
         if (curImages.size() != imgLoader.getMaxImgId())
             break;
-    
-        // Send the group of images to the job queue
-        JobIdPair pair(++jobId, std::move(curImages));
-        jobQueue.push(pair);
+
+        enqueueTimes.push_back(TIME.now());
+        results.push_back(session.submit(std::move(curImages), std::move(curRegImages)));
     }
     std::cout << "Finished sending all stitch jobs to job queue." << std::endl;
 
-    // Get the result images
+    // Get the result images, the session delivers them in the order they were sent
     std::cout << "Acquiring all stitched images from result queue." << std::endl;
-    jobId = 1;
-    std::vector<ResIdPair> jobResults;
-    while (!quit)
+    bool stitched(true);
+    START_TIME = TIME.now();
+    for (unsigned int i = 0; i < results.size() && !quit; i++)
     {
-        // Track the time acquired to get result images
-        START_TIME = TIME.now();
-        ResIdPair jobRes = std::move(resQueue.pop());
+        // Progressive mode shows the previews while the full image is still being stitched. waitKey
+        // returns at once until a preview window exists, so the wait on the result paces the loop.
+        while (previewQueue && results[i].wait_for(PREVIEW_POLL_INTERVAL) != std::future_status::ready)
+        {
+            ResIdPair previewRes;
+            while (previewQueue->tryPop(previewRes))
+                outputResult(previewRes, previewScale, "", true);
+            cv::waitKey(1);
+        }
+        ResIdPair res(i + 1, results[i].get());
 
-        // Make sure the image is valid
-        if (jobRes.second.empty())
+        // A failed image group does not hold back the ones after it
+        if (res.second.empty())
         {
-            std::cerr << "Error(stitchAllImgs): Acquired stitched image for id - " << jobRes.first << " is empty." << std::endl;
-            return false;
+            std::cerr << "Error(stitchAllImgs): Acquired stitched image for id - " << res.first << " is empty." << std::endl;
+            stitched = false;
+            continue;
         }
 
         // Get the time taken to acquire this final stitched image
         auto end = TIME.now();
         TOTAL_STITCH_TIME += std::chrono::duration_cast<std::chrono::milliseconds>(end - START_TIME).count();
+        START_TIME = end;
+
+        // Previews already took care of display
+        outputResult(res, outputScale, outputDir, previewQueue == nullptr);
+        frameLatency->record(TIME.now() - enqueueTimes[i]);
+        if (outputFrames)
+            outputFrames->add(1);
+
         if ((++TOTAL_FINAL_STITCHES % 10) == 0)
         {
             std::cout << "Average time elapsed from last final stitched image: " << TOTAL_STITCH_TIME / TOTAL_FINAL_STITCHES << "ms" << std::endl;
+            std::cout << "Frame latency p50/p99: " << frameLatency->getQuantileMicros(0.5) / 1000.0 << "ms/"
+                      << frameLatency->getQuantileMicros(0.99) / 1000.0 << "ms" << std::endl;
         }
+    }
+    std::cout << "Finished acquiring all stitch jobs from result queue." << std::endl;
+    return stitched;
+}
 
-        // Ensure this job result should be displayed next
-        bool foundResToDisplay = jobRes.first == jobId ? true : false;
-        if (!foundResToDisplay)
-        {
-            jobResults.push_back(std::move(jobRes));
-
-            // See if we have the next job result stored already
-            for (auto itr = jobResults.begin(); itr != jobResults.end(); itr++)
-            {
-                if (itr->first == jobId)
-                {
-                    jobRes = std::move(*itr);
-                    jobResults.erase(itr);
-                    foundResToDisplay = true;
-                    break;
-                }
-            }
-        }
+void outputResult(ResIdPair& res, float resultScale, const std::string& outputDir, bool display)
+{
+    if (!outputDir.empty())
+    {
+        std::filesystem::path outputPath = std::filesystem::path(outputDir) / (std::to_string(res.first) + ".png");
+        if (!cv::imwrite(outputPath.string(), res.second))
+            std::cerr << "Error(outputResult): Failed to write stitched image - " << outputPath << std::endl;
+    }
 
-        if (foundResToDisplay)
-        {
-            // Display the stitched image
-            cv::resize(jobRes.second, jobRes.second, cv::Size(), DISPLAY_PERCENTAGE, DISPLAY_PERCENTAGE);
-            cv::imshow("Stitched Image", jobRes.second);
-            cv::waitKey(1);
-            ++jobId;
-        }
+    if (display)
+    {
+        // Results composited at the display scale are shown as is
+        float displayScale = DISPLAY_PERCENTAGE / resultScale;
+        if (std::abs(displayScale - 1.0f) > 0.01f)
+            cv::resize(res.second, res.second, cv::Size(), displayScale, displayScale, cv::INTER_AREA);
+        cv::imshow("Stitched Image", res.second);
+        cv::waitKey(1);
     }
-    std::cout << "Finished acquiring all stitch jobs from result queue." << std::endl;
-    return true;
 }
 
 void printUsage() {
-    printf("ParallelPanorama <num-stitcher-worker-threads> <stitcher-mode | (manual) (opencv)> <top-level-img-directory-path>\n");
+    printf("ParallelPanorama <num-stitcher-worker-threads> <stitcher-mode | (manual) (opencv)> <top-level-img-directory-path> [options]\n");
+    printf("ParallelPanorama <num-stitcher-worker-threads> <stitcher-mode | (manual) (opencv)> --shm-attach=<name> [options]\n");
     printf("NOTE: Top-level image diretory must contain subdirectories that contain images\n");
-    printf("\tand are named with a numeric value to represent the image stitch position");
+    printf("\tand are named with a numeric value to represent the image stitch position\n");
+    printf("Options:\n");
+    printf("\t--native-pixels\tLoad images in their stored format (8UC1, 8UC3, 8UC4, 16UC3) instead of 8-bit BGR\n");
+    printf("\t--cache-dir=<path>\tReuse stitched images from, and store them to, an on-disk cache\n");
+    printf("\t--cache-size-mb=<n>\tMaximum size of the on-disk cache before evicting least recently used images (default 1024)\n");
+    printf("\t--calibration=<path>\tLoad a rig calibration and skip registration for the manual stitcher\n");
+    printf("\t--export-calibration=<path>\tSave the registration of the first stitched image group as a rig calibration\n");
+    printf("\t--export-warp-maps\tInclude precomputed warp maps in the exported calibration\n");
+    printf("\t--output-scale=<f>\tScale the images are composited at (default: display scale, or 1 with --output-dir or --export-calibration)\n");
+    printf("\t--output-dir=<path>\tWrite the stitched images to this directory\n");
+    printf("\t--progressive\tDisplay a low resolution preview before each full image is stitched (requires --output-dir)\n");
+    printf("\t--shm-name=<name>\tShare the stitch jobs with worker processes through a shared memory channel\n");
+    printf("\t--shm-attach=<name>\tRun as a worker process of the coordinator that created the channel\n");
+    printf("\t--shm-jobs=<n>\tNumber of jobs the shared memory channel holds at once (default 8)\n");
+    printf("\t--tiled-tiff\tComposite tile by tile with bounded memory and write <id>.tif files to the output directory\n");
+    printf("\t--tile-cache-mb=<n>\tMemory for canvas tiles before they are spilled to disk (default 256)\n");
+    printf("\t--registration-scale=<n>\tRegister on images decoded at 1/n resolution (2, 4 or 8, manual stitcher only)\n");
+    printf("\t--incremental\tOnly composite again the parts of the canvas whose source images changed (manual stitcher only, not with --progressive or --cache-dir)\n");
+    printf("\t--intra-op-threads=<n>\tThreads OpenCV and OpenMP may use within each job (default: adapts to the queued jobs)\n");
+    printf("\t--registration-threads=<n>\tRegister jobs on n separate threads, the stitcher worker threads only composite them\n");
+    printf("\t--pipeline-depth=<n>\tRegistered jobs waiting for compositing before registration blocks (default 4)\n");
+    printf("\t--metrics-file=<path>\tPeriodically write metrics to this file in the Prometheus text format\n");
+    printf("\t--metrics-socket=<path>\tServe metrics in the Prometheus text format on this Unix socket\n");
+    printf("\t--metrics-interval=<s>\tSeconds between metrics file updates (default 5)\n");
 }